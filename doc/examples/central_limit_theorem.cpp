@@ -65,7 +65,7 @@ auto get_opts(int argc, char *argv[])
          cxxopts::value<unsigned>()->default_value("500"))
         ("c,cloud", "Run in the cloud",
          cxxopts::value<bool>()->default_value("false"))
-        ("p,policy", "seq, par, cloud",
+        ("p,policy", "seq, par, cloud, cloud_reduce, hybrid",
          cxxopts::value<string>())
         ("h,help", "Print usage");
     auto result = options.parse(argc, argv);
@@ -131,7 +131,24 @@ void run_test(auto policy, opts const &o, auto f)
 
 }
 
+// Local cores compute experiments too while waiting on Lambda
+void run_hybrid(opts const &o)
+{
+    vector<exp_parameters> specification( o.experiments, { o.lambda, o.samples});
+    vector<double> means(o.experiments);
+
+    transform(cloud_hybrid{}, specification.begin(), specification.end(), means.begin(), cloud_exp_mean, exp_mean);
+
+    cout << scaled_hist(means);
+}
 
+// Only the mean of the means is needed, so sum them in the cloud rather than shipping them all back
+void run_mean(opts const &o)
+{
+    vector<exp_parameters> specification( o.experiments, { o.lambda, o.samples});
+    auto total = transform_reduce(cloud_launch::cloud, specification.begin(), specification.end(), 0.0, cloud_exp_mean);
+    cout << format("Mean of {} experiment means: {:6.3f}\n", o.experiments, total / o.experiments);
+}
 
 int main(int argc, char *argv[])
 {
@@ -147,6 +164,10 @@ int main(int argc, char *argv[])
         run_test(par_unseq, o, exp_mean);
     else if (o.policy == "cloud_launch" || o.policy == "cloud")
         run_test(cloud_launch::cloud, o, cloud_exp_mean);
+    else if (o.policy == "cloud_reduce")
+        run_mean(o);
+    else if (o.policy == "hybrid")
+        run_hybrid(o);
     else
         cerr << format("Invalid execution policy: {}", o.policy);
     return 0;
@@ -0,0 +1,102 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Measures the cost per call of encoding arguments into an invocation payload and decoding them in the
+// handler, and the bytes on the wire, for the previous path (ByteBuffer, SDK base64, readable JsonValue)
+// and the current one (thread local buffer, table base64, compact JSON, flat encoding of trivially copyable
+// types as with client.flatEncoding). Runs locally.
+//   codec_benchmark [iterations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <aws/core/Aws.h>
+#include <aws/core/utils/Array.h>
+#include <aws/core/utils/HashingUtils.h>
+#include <aws/core/utils/json/JsonSerializer.h>
+#include "awslabs/enhanced/detail/lambda_detail.h"
+
+using namespace AwsLabs::Enhanced;
+using Aws::Utils::Json::JsonValue;
+
+namespace {
+template <typename Holder>
+Aws::String previousEncode(Holder const &holder)
+{
+    std::vector<uint8_t> bytes;
+    auto written = alpaca::serialize(holder, bytes);
+    Aws::Utils::ByteBuffer byteBuffer(reinterpret_cast<unsigned char *>(bytes.data()), written);
+    JsonValue payload;
+    payload.WithString("serialized", Aws::Utils::HashingUtils::Base64Encode(byteBuffer));
+    Aws::StringStream stream(payload.View().WriteReadable());
+    return stream.str();
+}
+
+template <typename Holder>
+Holder previousDecode(Aws::String const &payload)
+{
+    JsonValue v(payload);
+    auto bb = Aws::Utils::HashingUtils::Base64Decode(v.View().GetString("serialized"));
+    std::vector<uint8_t> bytes(bb.GetUnderlyingData(), bb.GetUnderlyingData() + bb.GetLength());
+    std::error_code ec;
+    return alpaca::deserialize<Holder>(bytes, ec);
+}
+
+template <typename Holder>
+Aws::String currentEncode(Holder const &holder)
+{
+    Aws::StringStream stream;
+    Detail::writeCompactJson(stream, "serialized", Detail::encode(holder, true));
+    return stream.str();
+}
+
+template <typename Holder>
+Holder currentDecode(Aws::String const &payload)
+{
+    return Detail::decode<Holder>(*Detail::stringField(payload, "serialized"));
+}
+
+template <typename Holder>
+void measure(char const *name, Holder const &holder, unsigned iterations)
+{
+    auto time = [&](auto encode, auto decode) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t bytes = 0;
+        for (unsigned i = 0; i < iterations; ++i) {
+            auto payload = encode(holder);
+            bytes = payload.size();
+            auto decoded = decode(payload);
+            (void)decoded;
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        return std::pair(ns.count() / iterations, bytes);
+    };
+    auto [previousNs, previousBytes] = time(previousEncode<Holder>, previousDecode<Holder>);
+    auto [currentNs, currentBytes] = time(currentEncode<Holder>, currentDecode<Holder>);
+    std::cout << name << ": previous " << previousNs << " ns, " << previousBytes << " bytes; current "
+              << currentNs << " ns, " << currentBytes << " bytes\n";
+}
+}
+
+int main(int argc, char **argv)
+{
+    unsigned iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+    Aws::SDKOptions options;
+    Aws::InitAPI(options);
+    {
+        measure("two ints", Detail::ArgsHolder(std::tuple(0, 0, 1, 2)), iterations);
+        std::vector<double> samples(1000);
+        std::iota(samples.begin(), samples.end(), 0.5);
+        measure("1000 doubles", Detail::ArgsHolder(std::tuple(0, 0, samples)), iterations / 10);
+        std::vector<std::tuple<int, int>> batch(10000);
+        measure("batch of 10000 pairs", Detail::ArgsHolder(std::tuple(0, 0, batch)), iterations / 100);
+    }
+    Aws::ShutdownAPI(options);
+    return 0;
+}
@@ -3,12 +3,9 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "exp_mean.h"
-#include <random>
 
-double exp_mean(exp_parameters p)
+double exp_mean_from(std::mt19937 &gen, exp_parameters p)
 {
-    std::random_device rd;
-    std::mt19937 gen(rd());
     auto [lambda, samples] = p;
  
     // if particles decay once per second on average,
@@ -24,7 +21,19 @@ double exp_mean(exp_parameters p)
     return total/samples;
 }
 
+double exp_mean(exp_parameters p)
+{
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    return exp_mean_from(gen, p);
+}
+
 #ifdef AWS_LAMBDA
 #include "awslabs/enhanced/aws_lambda.h"
-AwsLabs::Enhanced::Handler handle(&exp_mean);
-#endif
\ No newline at end of file
+#include <functional>
+// Generators are seeded once per container rather than on every invocation.
+// Adding means lets transform_reduce(cloud_launch, ...) sum them inside the function
+AwsLabs::Enhanced::Handler handle(AwsLabs::Enhanced::withContext(
+                                      &exp_mean_from, [] { return std::mt19937(std::random_device()()); }),
+                                  std::plus<double>());
+#endif
@@ -2,9 +2,14 @@
  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
  * SPDX-License-Identifier: Apache-2.0
  */
+#include <random>
+
 struct exp_parameters {
     double lambda;
     unsigned samples;
 };
 
-double exp_mean(exp_parameters);
\ No newline at end of file
+double exp_mean(exp_parameters);
+
+// Draws from gen instead of seeding a generator
+double exp_mean_from(std::mt19937 &gen, exp_parameters);
\ No newline at end of file
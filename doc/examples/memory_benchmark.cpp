@@ -0,0 +1,69 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Measures Lambda invocations per second with the SDK default allocator or with pooled_memory_system.
+// Uses the add function deployed by the lambda_add example.
+//   memory_benchmark [invocations] [pooled]
+// The SDK only calls the memory manager when built with -DCUSTOM_MEMORY_MANAGEMENT=ON, so build against such
+// an SDK. The pooled run fails when the manager saw no allocations, as it then measured the default allocator.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include "awslabs/enhanced/lambda_client.h"
+#include "awslabs/enhanced/Aws.h"
+#include "awslabs/enhanced/pooled_memory.h"
+
+using namespace AwsLabs::Enhanced;
+
+namespace lambda_declarations {
+    int add(int, int);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned invocations = argc > 1 ? std::atoi(argv[1]) : 10000;
+    bool pooled = argc > 2 && std::strcmp(argv[2], "pooled") == 0;
+    AwsApi api(pooled ? with_pooled_memory() : Aws::SDKOptions{});
+    EnhancedLambdaClient client;
+    auto add = BIND_AWS_LAMBDA(client, lambda_declarations::add, "add");
+
+    std::vector<int> inputs(invocations);
+    std::iota(inputs.begin(), inputs.end(), 0);
+    std::vector<std::future<int>> futures;
+    futures.reserve(invocations);
+    auto start = std::chrono::steady_clock::now();
+    for (auto i : inputs) {
+        futures.push_back(async(cloud_launch::cloud, add, i, i));
+    }
+    long long failures = 0;
+    for (auto &f : futures) {
+        try {
+            f.get();
+        } catch (std::exception const &) {
+            ++failures;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << (pooled ? "pooled" : "default") << " allocator: " << invocations << " invocations in "
+              << elapsed.count() << "s, " << invocations / elapsed.count() << " invocations/s, "
+              << failures << " failures" << std::endl;
+    if (pooled) {
+        auto stats = pooled_memory_system::stats();
+        std::cout << "allocations " << stats.allocations << ", frees " << stats.frees
+                  << ", thread cache hits " << stats.cache_hits << ", refills " << stats.refills
+                  << ", large allocations " << stats.large_allocations << std::endl;
+        if (stats.allocations == 0) {
+            std::cerr << "pooled_memory_system saw no allocations, the SDK was not built with "
+                         "-DCUSTOM_MEMORY_MANAGEMENT=ON and the pooled run measured the default allocator" << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -9,18 +9,22 @@
 #include <aws/core/utils/logging/AWSLogging.h>
 #include <aws/core/utils/logging/LogSystemInterface.h>
 #include <aws/core/utils/logging/DefaultLogSystem.h>
+#include <awslabs/enhanced/async_log_system.h>
+#include <awslabs/enhanced/executor.h>
 
 namespace AwsLabs::Enhanced {
 struct AwsApi {
-  AwsApi(Aws::SDKOptions options = {}) : options(options) {
+  AwsApi(Aws::SDKOptions options = {}, const executor_options &executor = {}) : options(options) {
     static bool apiInitialized = false;
     if (apiInitialized) {
       throw std::runtime_error("Multiple AWS SDK initialization not allowed");
     }
+    configure_shared_executor(executor);
     Aws::InitAPI(options);
     apiInitialized = true;
   }
   ~AwsApi() {
+    release_shared_executor();
     Aws::ShutdownAPI(options);
   }
   Aws::SDKOptions options;
@@ -45,8 +49,31 @@ struct AwsLogging {
     Aws::Utils::Logging::InitializeAWSLogging(logSystem);
   }
 
+  AwsLogging(const async_log_options &async,
+             Aws::Utils::Logging::LogLevel logLevel,
+             const std::shared_ptr <Aws::OStream> logFile,
+             char const *allocationTag = "") {
+    asyncLogSystem = Aws::MakeShared<async_log_system>(allocationTag, logLevel, logFile, async);
+    Aws::Utils::Logging::InitializeAWSLogging(asyncLogSystem);
+  }
+
+  AwsLogging(const async_log_options &async,
+             Aws::Utils::Logging::LogLevel logLevel,
+             const Aws::String &filenamePrefix,
+             char const *allocationTag = "") {
+    asyncLogSystem = Aws::MakeShared<async_log_system>(allocationTag, logLevel, filenamePrefix, async);
+    Aws::Utils::Logging::InitializeAWSLogging(asyncLogSystem);
+  }
+
   ~AwsLogging() {
     Aws::Utils::Logging::ShutdownAWSLogging();
   }
+
+  // Messages dropped by the asynchronous log system, 0 for the other log systems
+  std::size_t droppedMessages() const {
+    return asyncLogSystem ? asyncLogSystem->dropped() : 0;
+  }
+
+  std::shared_ptr<async_log_system> asyncLogSystem;
 };
 }
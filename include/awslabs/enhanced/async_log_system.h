@@ -0,0 +1,633 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/core/utils/logging/LogLevel.h>
+#include <aws/core/utils/logging/LogSystemInterface.h>
+#include <aws/core/utils/memory/stl/AWSStringStream.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+struct async_log_options {
+  /**
+   * Size of the ring buffer of every logging thread. Messages that do not fit are dropped and counted.
+   */
+  std::size_t ring_bytes = 1024 * 1024;
+  /**
+   * How often the writer thread drains the ring buffers when nobody calls Flush.
+   */
+  std::chrono::milliseconds flush_interval = std::chrono::milliseconds(50);
+};
+
+namespace Detail {
+struct log_record_header {
+  std::uint32_t size;         // of the whole record, 0 marks padding up to the end of the ring
+  std::uint32_t message_size;
+  std::uint32_t format_size;  // when not 0, the message is a printf format of this size followed by its arguments
+  std::int64_t timestamp;     // nanoseconds since the epoch
+  std::uint64_t thread;
+  std::uint16_t tag_size;
+  Aws::Utils::Logging::LogLevel level;
+};
+
+/**
+ * Single producer single consumer ring of variable size log records. The logging thread is the producer
+ * and never blocks, the writer thread is the consumer.
+ */
+class log_ring {
+  std::unique_ptr<char[]> _buffer;
+  std::size_t _capacity;
+  alignas(64) std::atomic<std::size_t> _head = 0;
+  alignas(64) std::atomic<std::size_t> _tail = 0;
+  std::atomic<std::size_t> _dropped = 0;
+
+  static constexpr std::size_t align(std::size_t size) {
+    return (size + 7) & ~std::size_t(7);
+  }
+
+public:
+  explicit log_ring(std::size_t capacity)
+      : _capacity(std::bit_ceil(std::max<std::size_t>(capacity, 4096))) {
+    _buffer = std::make_unique<char[]>(_capacity);
+  }
+
+  /**
+   * Copies a record in the ring. Returns false and counts the record as dropped when the ring is full.
+   * Messages longer than a quarter of the ring are truncated.
+   */
+  bool push(const log_record_header &record, std::string_view tag, std::string_view message) {
+    tag = tag.substr(0, 255);
+    message = message.substr(0, _capacity / 4 - sizeof(log_record_header) - tag.size());
+    auto size = align(sizeof(log_record_header) + tag.size() + message.size());
+    auto tail = _tail.load(std::memory_order_relaxed);
+    auto pos = tail & (_capacity - 1);
+    auto contiguous = _capacity - pos;
+    auto needed = size <= contiguous ? size : contiguous + size;
+    if (_capacity - (tail - _head.load(std::memory_order_acquire)) < needed) {
+      _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    if (size > contiguous) {
+      std::uint32_t padding = 0;
+      std::memcpy(_buffer.get() + pos, &padding, sizeof(padding));
+      tail += contiguous;
+      pos = 0;
+    }
+    auto header = record;
+    header.size = static_cast<std::uint32_t>(size);
+    header.tag_size = static_cast<std::uint16_t>(tag.size());
+    header.message_size = static_cast<std::uint32_t>(message.size());
+    auto out = _buffer.get() + pos;
+    std::memcpy(out, &header, sizeof(header));
+    std::memcpy(out + sizeof(header), tag.data(), tag.size());
+    std::memcpy(out + sizeof(header) + tag.size(), message.data(), message.size());
+    _tail.store(tail + size, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Calls consume(header, tag, message) for every record in the ring and frees them.
+   */
+  template<typename Consumer>
+  void drain(Consumer &&consume) {
+    auto head = _head.load(std::memory_order_relaxed);
+    auto tail = _tail.load(std::memory_order_acquire);
+    while (head != tail) {
+      auto pos = head & (_capacity - 1);
+      auto in = _buffer.get() + pos;
+      std::uint32_t size;
+      std::memcpy(&size, in, sizeof(size));
+      if (!size) {
+        head += _capacity - pos;
+        continue;
+      }
+      log_record_header header;
+      std::memcpy(&header, in, sizeof(header));
+      consume(header,
+              std::string_view(in + sizeof(header), header.tag_size),
+              std::string_view(in + sizeof(header) + header.tag_size, header.message_size));
+      head += size;
+    }
+    _head.store(head, std::memory_order_release);
+  }
+
+  bool empty() const {
+    return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Longest message push stores without truncating it, whatever the tag.
+   */
+  std::size_t max_message() const {
+    return _capacity / 4 - sizeof(log_record_header) - 255;
+  }
+
+  std::size_t dropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+};
+
+/**
+ * A printf conversion, e.g. %-*.3lu.
+ */
+struct printf_conversion {
+  std::string_view spec; // from the % to the conversion character
+  bool width_argument = false;
+  bool precision_argument = false;
+  char length = 0;       // h, l, j, z, t or L, H for hh and q for ll
+  char conversion = 0;
+};
+
+/**
+ * Parses the conversion starting at the % at p. Returns the end of the conversion, or nullptr for
+ * conversions that are not deferred: positional arguments, %n and wide characters.
+ */
+inline const char *parse_conversion(const char *p, const char *end, printf_conversion &c) {
+  auto at = [&] { return p < end ? *p : '\0'; };
+  auto start = p++;
+  c = printf_conversion();
+  while (at() && std::strchr("-+ #0'", at())) {
+    ++p;
+  }
+  if (at() == '*') {
+    c.width_argument = true;
+    ++p;
+  }
+  while (at() >= '0' && at() <= '9') {
+    ++p;
+  }
+  if (at() == '.') {
+    ++p;
+    if (at() == '*') {
+      c.precision_argument = true;
+      ++p;
+    }
+    while (at() >= '0' && at() <= '9') {
+      ++p;
+    }
+  }
+  if (at() && std::strchr("hljztL", at())) {
+    c.length = *p++;
+    if ((c.length == 'h' || c.length == 'l') && at() == c.length) {
+      c.length = c.length == 'h' ? 'H' : 'q';
+      ++p;
+    }
+  }
+  c.conversion = at();
+  if (!c.conversion || !std::strchr("diouxXcspfFeEgGaA", c.conversion)) {
+    return nullptr;
+  }
+  if ((c.conversion == 'c' || c.conversion == 's') && c.length) {
+    return nullptr;
+  }
+  ++p;
+  c.spec = std::string_view(start, p - start);
+  return p;
+}
+
+template<typename T>
+void put_argument(std::string &out, char type, T value) {
+  out.push_back(type);
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template<typename T>
+T get_argument(std::string_view &in) {
+  T value;
+  std::memcpy(&value, in.data() + 1, sizeof(value));
+  in.remove_prefix(1 + sizeof(value));
+  return value;
+}
+
+/**
+ * Appends the arguments of format to out: integers widened to long long, floating point numbers,
+ * pointers, and copies of strings, whose pointers may not outlive the call. Returns false, leaving
+ * out incomplete, when format has a conversion that is not deferred.
+ */
+inline bool capture_printf_arguments(const char *format, va_list args, std::string &out) {
+  auto end = format + std::strlen(format);
+  for (auto p = format; p < end;) {
+    if (*p != '%') {
+      ++p;
+      continue;
+    }
+    if (p[1] == '%') {
+      p += 2;
+      continue;
+    }
+    printf_conversion c;
+    auto next = parse_conversion(p, end, c);
+    if (!next) {
+      return false;
+    }
+    if (c.width_argument) {
+      put_argument<long long>(out, 'i', va_arg(args, int));
+    }
+    if (c.precision_argument) {
+      put_argument<long long>(out, 'i', va_arg(args, int));
+    }
+    switch (c.conversion) {
+    case 'd':
+    case 'i':
+      switch (c.length) {
+      case 'l': put_argument<long long>(out, 'i', va_arg(args, long)); break;
+      case 'q': put_argument<long long>(out, 'i', va_arg(args, long long)); break;
+      case 'j': put_argument<long long>(out, 'i', va_arg(args, std::intmax_t)); break;
+      case 'z': put_argument<long long>(out, 'i', va_arg(args, std::make_signed_t<std::size_t>)); break;
+      case 't': put_argument<long long>(out, 'i', va_arg(args, std::ptrdiff_t)); break;
+      case 'H': put_argument<long long>(out, 'i', static_cast<signed char>(va_arg(args, int))); break;
+      case 'h': put_argument<long long>(out, 'i', static_cast<short>(va_arg(args, int))); break;
+      default: put_argument<long long>(out, 'i', va_arg(args, int));
+      }
+      break;
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+      switch (c.length) {
+      case 'l': put_argument<unsigned long long>(out, 'u', va_arg(args, unsigned long)); break;
+      case 'q': put_argument<unsigned long long>(out, 'u', va_arg(args, unsigned long long)); break;
+      case 'j': put_argument<unsigned long long>(out, 'u', va_arg(args, std::uintmax_t)); break;
+      case 'z': put_argument<unsigned long long>(out, 'u', va_arg(args, std::size_t)); break;
+      case 't': put_argument<unsigned long long>(out, 'u', va_arg(args, std::make_unsigned_t<std::ptrdiff_t>)); break;
+      case 'H': put_argument<unsigned long long>(out, 'u', static_cast<unsigned char>(va_arg(args, unsigned))); break;
+      case 'h': put_argument<unsigned long long>(out, 'u', static_cast<unsigned short>(va_arg(args, unsigned))); break;
+      default: put_argument<unsigned long long>(out, 'u', va_arg(args, unsigned));
+      }
+      break;
+    case 'c':
+      put_argument<long long>(out, 'i', va_arg(args, int));
+      break;
+    case 'p':
+      put_argument(out, 'p', va_arg(args, void *));
+      break;
+    case 's': {
+      auto string = va_arg(args, const char *);
+      std::string_view value = string ? string : "(null)";
+      put_argument(out, 's', static_cast<std::uint32_t>(value.size()));
+      out.append(value);
+      break;
+    }
+    default:
+      if (c.length == 'L') {
+        put_argument(out, 'L', va_arg(args, long double));
+      } else {
+        put_argument(out, 'f', va_arg(args, double));
+      }
+    }
+    p = next;
+  }
+  return true;
+}
+
+/**
+ * Appends to out the message of a format and the arguments captured by capture_printf_arguments.
+ */
+inline void format_printf(std::string_view format, std::string_view args, std::string &out) {
+  std::string spec;
+  char buffer[128];
+  auto end = format.data() + format.size();
+  for (auto p = format.data(); p < end;) {
+    if (*p != '%') {
+      auto literal = std::find(p, end, '%');
+      out.append(p, literal);
+      p = literal;
+      continue;
+    }
+    if (p + 1 < end && p[1] == '%') {
+      out.push_back('%');
+      p += 2;
+      continue;
+    }
+    printf_conversion c;
+    auto next = parse_conversion(p, end, c);
+    // Rebuilt with the stars replaced by their values and the length of the captured type
+    spec.clear();
+    for (auto ch : c.spec.substr(0, c.spec.size() - 1)) {
+      if (ch == '*') {
+        spec += std::to_string(get_argument<long long>(args));
+      } else if (!std::strchr("hljztL", ch)) {
+        spec.push_back(ch);
+      }
+    }
+    std::string string;
+    auto type = args.front();
+    if (type == 'i' || type == 'u') {
+      spec += c.conversion == 'c' ? "" : "ll";
+    } else if (type == 'L') {
+      spec += 'L';
+    }
+    spec.push_back(c.conversion);
+    auto print = [&](auto value) {
+      auto size = std::snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+      if (size < 0) {
+        return;
+      }
+      if (std::size_t(size) < sizeof(buffer)) {
+        out.append(buffer, size);
+      } else {
+        auto offset = out.size();
+        out.resize(offset + size + 1);
+        std::snprintf(out.data() + offset, size + 1, spec.c_str(), value);
+        out.resize(offset + size);
+      }
+    };
+    switch (type) {
+    case 'i':
+      if (c.conversion == 'c') {
+        print(static_cast<int>(get_argument<long long>(args)));
+      } else {
+        print(get_argument<long long>(args));
+      }
+      break;
+    case 'u': print(get_argument<unsigned long long>(args)); break;
+    case 'f': print(get_argument<double>(args)); break;
+    case 'L': print(get_argument<long double>(args)); break;
+    case 'p': print(get_argument<void *>(args)); break;
+    case 's': {
+      auto size = get_argument<std::uint32_t>(args);
+      string.assign(args.substr(0, size));
+      args.remove_prefix(size);
+      print(string.c_str());
+      break;
+    }
+    }
+    p = next;
+  }
+}
+}
+
+/**
+ * SDK log system that never blocks the logging threads on I/O or on each other.
+ * Every thread copies its messages into its own lock-free ring buffer, and a background writer thread
+ * formats them with their prefixes (level, UTC time, tag, thread) and writes them out. Printf style
+ * messages are stored as their format and arguments, and formatted on the logging thread only when they
+ * have conversions that are not deferred, such as %n or positional arguments. Messages that find their
+ * thread's ring full are dropped and counted in dropped().
+ */
+class async_log_system : public Aws::Utils::Logging::LogSystemInterface {
+  using LogLevel = Aws::Utils::Logging::LogLevel;
+
+  std::atomic<LogLevel> _level;
+  std::shared_ptr<Aws::OStream> _output;
+  async_log_options _options;
+  std::size_t _id;
+
+  std::mutex _rings_mutex;
+  std::vector<std::shared_ptr<Detail::log_ring>> _rings;
+  std::size_t _retired_dropped = 0; // dropped by rings of exited threads
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::size_t _flush_requested = 0;
+  std::size_t _flush_done = 0;
+  bool _stop = false;
+  std::string _batch;
+  std::thread _writer;
+
+  static std::size_t next_id() {
+    static std::atomic<std::size_t> id = 0;
+    return ++id;
+  }
+
+  static std::uint64_t thread_number() {
+    static thread_local auto number = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    return number;
+  }
+
+  static const char *level_name(LogLevel level) {
+    switch (level) {
+    case LogLevel::Fatal: return "FATAL";
+    case LogLevel::Error: return "ERROR";
+    case LogLevel::Warn: return "WARN";
+    case LogLevel::Info: return "INFO";
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Trace: return "TRACE";
+    default: return "";
+    }
+  }
+
+  /**
+   * The ring of the calling thread, registered on its first message.
+   * Threads keep their rings alive, the writer forgets the rings of exited threads once drained.
+   */
+  Detail::log_ring &ring() {
+    static thread_local std::vector<std::pair<std::size_t, std::shared_ptr<Detail::log_ring>>> rings;
+    for (auto &[id, ring] : rings) {
+      if (id == _id) {
+        return *ring;
+      }
+    }
+    std::erase_if(rings, [](const auto &entry) { return entry.second.use_count() == 1; }); // of destroyed log systems
+    auto ring = std::make_shared<Detail::log_ring>(_options.ring_bytes);
+    {
+      std::lock_guard lock(_rings_mutex);
+      _rings.push_back(ring);
+    }
+    rings.emplace_back(_id, ring);
+    return *ring;
+  }
+
+  void push(LogLevel level, const char *tag, std::string_view message, std::size_t format_size = 0) {
+    Detail::log_record_header header{};
+    header.level = level;
+    header.format_size = static_cast<std::uint32_t>(format_size);
+    header.thread = thread_number();
+    header.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    ring().push(header, tag ? std::string_view(tag) : std::string_view(), message);
+  }
+
+  void format(const Detail::log_record_header &header, std::string_view tag, std::string_view message) {
+    auto seconds = static_cast<std::time_t>(header.timestamp / 1000000000);
+    std::tm utc{};
+    gmtime_r(&seconds, &utc);
+    char prefix[64];
+    auto length = std::strftime(prefix, sizeof(prefix), "%Y-%m-%d %H:%M:%S", &utc);
+    std::snprintf(prefix + length, sizeof(prefix) - length, ".%03d", int(header.timestamp / 1000000 % 1000));
+    _batch.append("[").append(level_name(header.level)).append("] ").append(prefix).append(" ");
+    _batch.append(tag).append(" [").append(std::to_string(header.thread)).append("] ");
+    if (header.format_size) {
+      Detail::format_printf(message.substr(0, header.format_size), message.substr(header.format_size), _batch);
+    } else {
+      _batch.append(message);
+    }
+    _batch.append("\n");
+  }
+
+  void drain() {
+    std::vector<std::shared_ptr<Detail::log_ring>> rings;
+    {
+      std::lock_guard lock(_rings_mutex);
+      rings = _rings;
+    }
+    for (auto &ring : rings) {
+      ring->drain([this](const auto &header, auto tag, auto message) { format(header, tag, message); });
+    }
+    rings.clear();
+    if (!_batch.empty()) {
+      _output->write(_batch.data(), static_cast<std::streamsize>(_batch.size()));
+      _output->flush();
+      _batch.clear();
+    }
+    std::lock_guard lock(_rings_mutex);
+    std::erase_if(_rings, [this](const auto &ring) {
+      if (ring.use_count() > 1 || !ring->empty()) {
+        return false;
+      }
+      _retired_dropped += ring->dropped();
+      return true;
+    });
+  }
+
+  void write_in_background() {
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _cv.wait_for(lock, _options.flush_interval, [&] { return _stop || _flush_requested != _flush_done; });
+      auto stop = _stop;
+      auto requested = _flush_requested;
+      lock.unlock();
+      drain();
+      lock.lock();
+      _flush_done = requested;
+      _cv.notify_all();
+      if (stop) {
+        return;
+      }
+    }
+  }
+
+public:
+  /**
+   * Construct a log system writing messages up to level to output.
+   * @param level
+   * @param output
+   * @param options
+   */
+  async_log_system(LogLevel level, std::shared_ptr<Aws::OStream> output, async_log_options options = {})
+      : _level(level), _output(std::move(output)), _options(options), _id(next_id()) {
+    _writer = std::thread([this] { write_in_background(); });
+  }
+
+  /**
+   * Construct a log system writing messages up to level to a file named filename_prefix followed by
+   * the UTC date and hour of its creation, e.g. prefix2024-01-31-13.log.
+   * @param level
+   * @param filename_prefix
+   * @param options
+   */
+  async_log_system(LogLevel level, const Aws::String &filename_prefix, async_log_options options = {})
+      : async_log_system(level, open_log_file(filename_prefix), options) {}
+
+  async_log_system(const async_log_system &) = delete;
+  async_log_system &operator=(const async_log_system &) = delete;
+
+  ~async_log_system() override {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    _writer.join();
+  }
+
+  static std::shared_ptr<Aws::OStream> open_log_file(const Aws::String &filename_prefix) {
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char suffix[32];
+    std::strftime(suffix, sizeof(suffix), "%Y-%m-%d-%H.log", &utc);
+    return std::make_shared<std::ofstream>(std::string(filename_prefix.c_str()) + suffix, std::ios_base::app);
+  }
+
+  LogLevel GetLogLevel() const override {
+    return _level;
+  }
+
+  void SetLogLevel(LogLevel level) {
+    _level = level;
+  }
+
+  void Log(LogLevel level, const char *tag, const char *format, ...) override {
+    va_list args;
+    va_start(args, format);
+    vaLog(level, tag, format, args);
+    va_end(args);
+  }
+
+  void vaLog(LogLevel level, const char *tag, const char *format, va_list args) override {
+    static thread_local std::string deferred;
+    deferred.assign(format);
+    auto format_size = deferred.size();
+    va_list captured;
+    va_copy(captured, args);
+    auto capturable = format_size && Detail::capture_printf_arguments(format, captured, deferred);
+    va_end(captured);
+    if (capturable && deferred.size() <= ring().max_message()) {
+      push(level, tag, deferred, format_size);
+      return;
+    }
+    static thread_local std::vector<char> message(512);
+    va_list retry;
+    va_copy(retry, args);
+    auto size = std::vsnprintf(message.data(), message.size(), format, args);
+    if (size >= 0 && std::size_t(size) >= message.size()) {
+      message.resize(size + 1);
+      std::vsnprintf(message.data(), message.size(), format, retry);
+    }
+    va_end(retry);
+    push(level, tag, std::string_view(message.data(), std::max(size, 0)));
+  }
+
+  void LogStream(LogLevel level, const char *tag, const Aws::OStringStream &messageStream) override {
+    auto message = messageStream.str();
+    push(level, tag, std::string_view(message.data(), message.size()));
+  }
+
+  /**
+   * Blocks until the messages logged so far are written out.
+   */
+  void Flush() override {
+    std::unique_lock lock(_mutex);
+    auto ticket = ++_flush_requested;
+    _cv.notify_all();
+    _cv.wait(lock, [&] { return _flush_done >= ticket || _stop; });
+  }
+
+  /**
+   * Number of messages dropped because the ring of their thread was full.
+   * @return
+   */
+  std::size_t dropped() {
+    std::lock_guard lock(_rings_mutex);
+    auto dropped = _retired_dropped;
+    for (auto &ring : _rings) {
+      dropped += ring->dropped();
+    }
+    return dropped;
+  }
+};
+}
@@ -6,10 +6,25 @@
 #pragma once
 
 #include <aws/lambda-runtime/runtime.h>
+#include <aws/core/Aws.h>
 #include <aws/core/utils/json/JsonSerializer.h>
 #include <aws/core/utils/HashingUtils.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #ifdef __cpp_lib_expected
 #include <expected>
 namespace expns = std;
@@ -18,6 +33,7 @@ namespace expns = std;
 namespace expns = tl;
 #endif
 #include <string>
+#include <string_view>
 #include <utility>
 #include <sstream>
 #include <alpaca/alpaca.h>
@@ -26,6 +42,8 @@ using namespace aws::lambda_runtime;
 using namespace std::string_literals;
 using Aws::Utils::Json::JsonValue;
 #include "detail/lambda_detail.h"
+#include "detail/lambda_offload.h"
+#include "lambda_broadcast.h"
 
 namespace AwsLabs::Enhanced {
 template <typename Func>
@@ -49,7 +67,7 @@ namespace Detail {
   {
     JsonValue result;
     putValue(result, r);
-    return invocation_response::success(result.View().WriteReadable(), "application/json");
+    return invocation_response::success(Detail::toStdString(result.View().WriteReadable()), "application/json");
   }
 
   invocation_response makeResponse(invocation_response const &ir)
@@ -57,36 +75,165 @@ namespace Detail {
     return ir;
   }
 
+  // Results above the threshold the client asked for are offloaded to S3
+  // Handlers initialize the SDK on the first invocation using S3, never shutting it down
+  inline void initSdkForOffload()
+  {
+    static std::once_flag once;
+    std::call_once(once, [] {
+      static Aws::SDKOptions options;
+      Aws::InitAPI(options);
+    });
+  }
+
+  // Results are encoded flat only for clients asking for it, as older ones cannot read it
   template<typename R>
-  invocation_response makeBase64Response(R const &r)
+  invocation_response makeBase64Response(R const &r, LambdaOffload const *offload, bool flat)
   {
-    Detail::ResultHolder<R> resultHolder(r);
-    JsonValue result;
-    std::vector<uint8_t> bytes;
-    auto bytes_written = alpaca::serialize(resultHolder, bytes);
-    static_assert(sizeof(uint8_t) == sizeof(unsigned char), "Platform breaks our assumption that characters are 8 bits");
-    Aws::Utils::ByteBuffer byteBuffer(reinterpret_cast<unsigned char *>(&bytes.front()), bytes_written);
-    result.WithString("value",  Aws::Utils::HashingUtils::Base64Encode(byteBuffer));
-    return invocation_response::success(result.View().WriteReadable(), "application/json");
+    return invocation_response::success("{" + encodeField("value", Detail::ResultHolder<R>(r), offload, flat) + "}",
+                                        "application/json");
   }
 
+  // Runs f(0) ... f(n - 1) on all the vCPUs of the container, rethrowing the first exception
+  template <typename F>
+  void forEachParallel(std::size_t n, F const &f)
+  {
+    auto workers = std::min<std::size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<std::size_t> next = 0;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto work = [&] {
+      for (std::size_t i; (i = next++) < n;) {
+        try {
+          f(i);
+        } catch (...) {
+          std::lock_guard lock(errorMutex);
+          if (!error)
+            error = std::current_exception();
+          next = n;
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t w = 1; w < workers; ++w)
+      threads.emplace_back(work);
+    work();
+    for (auto &thread : threads)
+      thread.join();
+    if (error)
+      std::rethrow_exception(error);
+  }
+
+  // Runs every argument tuple of a batch and reports the time spent so clients can size their batches
   template <typename R, typename... Args>
-  invocation_response call(std::function<R(Args...)> const &f,
+  using BatchHolder = Detail::ArgsHolder<int, int, std::vector<std::tuple<std::decay_t<Args>...>>>;
+
+  template <typename R, typename... Args>
+  invocation_response callBatch(std::function<R(Args...)> const &f, BatchHolder<R, Args...> const &argsHolder,
+                                LambdaOffload const *offload, bool flat)
+  {
+    auto const &items = std::get<2>(argsHolder.tup);
+    std::vector<std::optional<R>> computed(items.size());
+    auto start = std::chrono::steady_clock::now();
+    forEachParallel(items.size(), [&](std::size_t i) { computed[i] = std::apply(f, items[i]); });
+    auto computeTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::vector<R> values;
+    values.reserve(computed.size());
+    for (auto &value : computed)
+      values.push_back(std::move(*value));
+    auto payload = "{" + encodeField("values", Detail::ResultHolder<std::vector<R>>(values), offload, flat)
+                   + ",\"compute_us\":" + std::to_string(computeTime.count()) + "}";
+    return invocation_response::success(payload, "application/json");
+  }
+
+  // Folds map(0) ... map(n - 1) with op, n > 0. Each vCPU folds a contiguous range and the
+  // partial results are folded in order.
+  template <typename T, typename Map, typename Op>
+  T foldParallel(std::size_t n, Map const &map, Op const &op)
+  {
+    auto parts = std::min<std::size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::optional<T>> partials(parts);
+    forEachParallel(parts, [&](std::size_t part) {
+      auto first = n * part / parts, last = n * (part + 1) / parts;
+      T acc = map(first);
+      for (auto i = first + 1; i < last; ++i)
+        acc = op(std::move(acc), map(i));
+      partials[part] = std::move(acc);
+    });
+    T acc = std::move(*partials[0]);
+    for (std::size_t part = 1; part < parts; ++part)
+      acc = op(std::move(acc), std::move(*partials[part]));
+    return acc;
+  }
+
+  // The operation folding results of f: op when the handler was given one, otherwise f itself when
+  // it is a binary operation on its result type
+  template <typename R, typename... Args, typename Op>
+  std::function<R(R, R)> reduction(std::function<R(Args...)> const &f, Op const &op)
+  {
+    if constexpr (std::is_invocable_r_v<R, Op const &, R, R>)
+      return op;
+    else if constexpr (std::is_invocable_r_v<R, std::function<R(Args...)> const &, R, R>)
+      return f;
+    else
+      return [](R, R) -> R { throw std::runtime_error("The handler has no reduction operation"); };
+  }
+
+  template <typename R>
+  invocation_response callReduce(std::function<R(R, R)> const &op,
+                                 Detail::ArgsHolder<int, int, std::vector<R>> const &argsHolder,
+                                 LambdaOffload const *offload, bool flat)
+  {
+    auto const &values = std::get<2>(argsHolder.tup);
+    if (values.empty())
+      throw std::runtime_error("Nothing to reduce");
+    return makeBase64Response(foldParallel<R>(values.size(), [&](std::size_t i) { return values[i]; }, op), offload,
+                              flat);
+  }
+
+  template <typename R, typename... Args>
+  invocation_response callTransformReduce(std::function<R(Args...)> const &f,
+                                          std::function<R(R, R)> const &op,
+                                          BatchHolder<R, Args...> const &argsHolder,
+                                          LambdaOffload const *offload, bool flat)
+  {
+    auto const &items = std::get<2>(argsHolder.tup);
+    if (items.empty())
+      throw std::runtime_error("Nothing to reduce");
+    return makeBase64Response(foldParallel<R>(items.size(), [&](std::size_t i) { return std::apply(f, items[i]); }, op),
+                              offload, flat);
+  }
+
+  template <typename R, typename... Args, typename Op>
+  invocation_response call(std::function<R(Args...)> const &f, Op const &op,
                            invocation_request const &req)
   {
-    static_assert(sizeof(uint8_t) == sizeof(unsigned char), "Platform breaks our assumption that characters are 8 bits");
-    JsonValue v = req.payload;
-    Aws::Utils::ByteBuffer bb = Aws::Utils::HashingUtils::Base64Decode(v.View().GetString("serialized"));
-    std::vector<uint8_t> bytes(reinterpret_cast<uint8_t *>(bb.GetUnderlyingData()),
-                               reinterpret_cast<uint8_t *>(bb.GetUnderlyingData() + bb.GetLength()));
-    std::error_code ec;
+    // Payloads are compact JSON objects whose base64 fields are found without parsing the JSON
+    auto offload = offloadRequested(req.payload);
+    auto target = offload ? &*offload : nullptr;
+    auto flat = int64Field(req.payload, flatField).value_or(0) != 0;
+    if (offload || takesBroadcast<Args...> || req.payload.find("_s3\"") != std::string::npos)
+      initSdkForOffload();
+    if (auto batch = decodeField<BatchHolder<R, Args...>>(req.payload, "batch"))
+      return callBatch(f, *batch, target, flat);
+    if (auto items = decodeField<BatchHolder<R, Args...>>(req.payload, "transform_reduce"))
+      return callTransformReduce(f, reduction(f, op), *items, target, flat);
+    if (auto values = decodeField<Detail::ArgsHolder<int, int, std::vector<R>>>(req.payload, "reduce"))
+      return callReduce(reduction(f, op), *values, target, flat);
     // Dummy arguments address https://github.com/p-ranav/alpaca/issues/22#issuecomment-1569568081
+    auto argsHolder = decodeField<Detail::ArgsHolder<int, int, Args...>>(req.payload, "serialized");
+    if (!argsHolder)
+      throw std::runtime_error("Payload has no serialized arguments");
 
-    auto argsHolder = alpaca::deserialize<Detail::ArgsHolder<int, int, Args...>>(bytes, ec);
-    if(ec) 
-      throw std::runtime_error("Deserialization error code: " + ec.message());
+    return makeBase64Response(std::apply([&](int, int, auto...args) { return f(args...); }, argsHolder->tup), target,
+                              flat);
+  };
 
-    return makeBase64Response(std::apply([&](int, int, auto...args) { return f(args...); }, argsHolder.tup));
+  template <typename R, typename... Args>
+  invocation_response call(std::function<R(Args...)> const &f,
+                           invocation_request const &req)
+  {
+    return call(f, nullptr, req);
   };
 
   template <typename R>
@@ -103,6 +250,73 @@ namespace Detail {
     return makeResponse(f(req));
   };
 
+  // Prewarm invocations are held so concurrent ones land on distinct containers, and never reach the function.
+  // They are only looked for in small payloads.
+  inline std::optional<invocation_response> answerPrewarm(invocation_request const &req)
+  {
+    if (req.payload.size() > 128)
+      return std::nullopt;
+    auto hold = int64Field(req.payload, prewarmField);
+    if (!hold)
+      return std::nullopt;
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::clamp<int64_t>(*hold, 0, 10000)));
+    return invocation_response::success("{}", "application/json");
+  }
+
+  // Time spent building contexts and in the calls using them since the last response that reported it.
+  // Lambda runs one invocation at a time per container, and the context built at container start is
+  // reported with the first invocation.
+  struct ContextTimes
+  {
+    std::atomic<int64_t> initUs = 0;
+    std::atomic<int64_t> callUs = 0;
+    std::atomic<std::size_t> calls = 0;
+  };
+
+  inline ContextTimes &contextTimes()
+  {
+    static ContextTimes times;
+    return times;
+  }
+
+  // Appends "context_init_us" and "context_us" to the JSON response of an invocation that used contexts
+  inline invocation_response reportContextTimes(invocation_response response)
+  {
+    auto &times = contextTimes();
+    if (!times.calls.exchange(0))
+      return response;
+    auto init = times.initUs.exchange(0);
+    auto call = times.callUs.exchange(0);
+    auto const &payload = response.get_payload();
+    if (!response.is_success() || payload.size() < 2 || payload.back() != '}')
+      return response;
+    return invocation_response::success(payload.substr(0, payload.size() - 1) + (payload.size() > 2 ? "," : "")
+                                          + "\"context_init_us\":" + std::to_string(init)
+                                          + ",\"context_us\":" + std::to_string(call) + "}",
+                                        "application/json");
+  }
+
+  // Event invocations return nothing to the client, so their response is written where it asked instead.
+  // Lambda is told they succeeded so it does not run them again, unless the write failed. The client keeps
+  // offloaded arguments until the result arrived, so those retries still find them.
+  inline invocation_response deliverEvent(invocation_request const &req, invocation_response response)
+  {
+    auto location = stringField(req.payload, eventResultField);
+    if (!location)
+      return response;
+    try
+    {
+      initSdkForOffload();
+      auto const &payload = response.get_payload();
+      writeOffloaded(parseLocation(*location), std::vector<uint8_t>(payload.begin(), payload.end()));
+    }
+    catch (std::exception const &exc)
+    {
+      return invocation_response::failure(exc.what(), "application/json");
+    }
+    return invocation_response::success("{}", "application/json");
+  }
+
   template <typename Func>
   invocation_response respond(Func const &f, invocation_request const &req)
   {
@@ -116,6 +330,19 @@ namespace Detail {
     }
   }
 
+  template <typename Func, typename Op>
+  invocation_response respond(Func const &f, Op const &op, invocation_request const &req)
+  {
+    try
+    {
+      return call(f, op, req);
+    }
+    catch (std::exception const &exc)
+    {
+      return invocation_response::failure(exc.what(), "application/json");
+    }
+  }
+
   template <typename R, typename... Args>
   invocation_response respond(std::function<expns::expected<R, std::string>(Args...)> const &f,
                               invocation_request const &req)
@@ -130,7 +357,106 @@ namespace Detail {
 
 }
 
-template <typename Func>
+// Contexts of a function, e.g. parsed models, clients or random number generators, built by make: one
+// at container start and more when calls of a batch run concurrently. Each call has a context to itself,
+// and contexts are kept across warm invocations. The time spent building contexts and in the calls using
+// them is returned to the client with each response.
+template <typename Ctx>
+class ContextPool
+{
+public:
+  explicit ContextPool(std::function<Ctx()> make) : make(std::move(make))
+  {
+    idle.push_back(build());
+  }
+
+  template <typename F>
+  decltype(auto) use(F const &f)
+  {
+    std::unique_ptr<Ctx> ctx;
+    {
+      std::lock_guard lock(mutex);
+      if (!idle.empty())
+      {
+        ctx = std::move(idle.back());
+        idle.pop_back();
+      }
+    }
+    if (!ctx)
+      ctx = build();
+    struct Release
+    {
+      ContextPool &pool;
+      std::unique_ptr<Ctx> &ctx;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      ~Release()
+      {
+        auto &times = Detail::contextTimes();
+        times.callUs += elapsedUs(start);
+        ++times.calls;
+        std::lock_guard lock(pool.mutex);
+        pool.idle.push_back(std::move(ctx));
+      }
+    } release{*this, ctx};
+    return f(*ctx);
+  }
+
+private:
+  static int64_t elapsedUs(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  std::unique_ptr<Ctx> build()
+  {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Ctx> ctx(new Ctx(make()));
+    Detail::contextTimes().initUs += elapsedUs(start);
+    return ctx;
+  }
+
+  std::function<Ctx()> make;
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Ctx>> idle;
+};
+
+// A function taking a context before the arguments the client passes
+template <typename Ctx, typename R, typename... Args>
+struct WithContext
+{
+  R operator()(Args... args) const
+  {
+    return pool->use([&](Ctx &ctx) { return f(ctx, args...); });
+  }
+
+  R (*f)(Ctx &, Args...);
+  std::shared_ptr<ContextPool<Ctx>> pool;
+};
+
+/**
+ * Binds f to contexts built by make, for handlers of functions keeping state across invocations, e.g.
+ * Handler handle(withContext(&sample, [] { return std::mt19937(std::random_device()()); }));
+ * The client binds the function without the context parameter.
+ * @param f
+ * @param make
+ * @return
+ */
+template <typename Ctx, typename R, typename... Args, typename Make>
+WithContext<Ctx, R, Args...> withContext(R (*f)(Ctx &, Args...), Make make)
+{
+  return {f, std::make_shared<ContextPool<Ctx>>(std::function<Ctx()>(make))};
+}
+
+template <typename Ctx, typename R, typename... Args>
+WithContext<Ctx, R, Args...> withContext(R (*f)(Ctx &, Args...))
+{
+  return withContext(f, [] { return Ctx(); });
+}
+
+// Runs func for every invocation. Handlers given a binary operation op, e.g. Handler(&f, &op),
+// also fold chunks of results of func with op for the cloud transform_reduce. Handlers of a
+// binary operation on its result type fold with func for the cloud reduce.
+template <typename Func, typename Op = std::nullptr_t>
 struct Handler
 {
   template <typename H>
@@ -139,15 +465,101 @@ struct Handler
     run_handler(*this);
   }
 
+  template <typename H, typename O>
+  Handler(H h, O o) : func(h), op(o)
+  {
+    run_handler(*this);
+  }
+
   invocation_response operator()(invocation_request const &req)
   {
-    return Detail::respond(func, req);
+    if (auto prewarmed = Detail::answerPrewarm(req))
+      return *prewarmed;
+    if constexpr (std::is_same_v<Op, std::nullptr_t>)
+      return Detail::deliverEvent(req, Detail::reportContextTimes(Detail::respond(func, req)));
+    else
+      return Detail::deliverEvent(req, Detail::reportContextTimes(Detail::respond(func, op, req)));
   }
   Func func;
+  Op op{};
 };
 
 template <typename Func>
 Handler(Func) -> Handler<make_function_t<Func>>;
+
+template <typename Func, typename Op>
+Handler(Func, Op) -> Handler<make_function_t<Func>, make_function_t<Op>>;
+
+// A function hosted by a MultiplexedHandler, identified by its name and signature
+struct Registered
+{
+  uint32_t id;
+  std::string name;
+  std::function<invocation_response(invocation_request const &)> respond;
+};
+
+namespace Detail {
+  template <typename Func>
+  struct Signature;
+
+  template <typename R, typename... Args>
+  struct Signature<std::function<R(Args...)>>
+  {
+    using type = R(Args...);
+  };
+}
+
+template <typename F>
+Registered registered(std::string_view name, F f)
+{
+  make_function_t<F> func(f);
+  return {Detail::functionId<typename Detail::Signature<decltype(func)>::type>(name), std::string(name),
+          [func](invocation_request const &req) { return Detail::respond(func, req); }};
+}
+
+// Also folding results with op, as Handler(func, op) does
+template <typename F, typename Op>
+Registered registered(std::string_view name, F f, Op o)
+{
+  make_function_t<F> func(f);
+  make_function_t<Op> op(o);
+  return {Detail::functionId<typename Detail::Signature<decltype(func)>::type>(name), std::string(name),
+          [func, op](invocation_request const &req) { return Detail::respond(func, op, req); }};
+}
+
+// Hosts many functions in one deployment, sharing its warm containers, and runs the one whose ID the
+// client bound with BIND_AWS_LAMBDA_FUNCTION put in the payload, e.g.
+// MultiplexedHandler handle(registered("add", &add), registered("mean", &mean, std::plus<double>()));
+struct MultiplexedHandler
+{
+  template <typename... Entries>
+  MultiplexedHandler(Entries... entries)
+  {
+    for (auto &entry : std::initializer_list<Registered>{std::move(entries)...})
+    {
+      auto [found, inserted] = functions.emplace(entry.id, entry);
+      if (!inserted)
+        throw std::runtime_error("Functions " + found->second.name + " and " + entry.name + " have the same ID");
+    }
+    run_handler(*this);
+  }
+
+  invocation_response operator()(invocation_request const &req)
+  {
+    if (auto prewarmed = Detail::answerPrewarm(req))
+      return *prewarmed;
+    auto id = Detail::int64Field(req.payload, "function");
+    if (!id)
+      return invocation_response::failure("Payload names no function", "application/json");
+    auto found = functions.find(static_cast<uint32_t>(*id));
+    if (found == functions.end())
+      return invocation_response::failure("No function with ID " + std::to_string(*id) + " is registered",
+                                          "application/json");
+    return Detail::deliverEvent(req, Detail::reportContextTimes(found->second.respond(req)));
+  }
+
+  std::map<uint32_t, Registered> functions;
+};
 }
 
 int main()
@@ -0,0 +1,31 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/core/utils/memory/stl/AWSString.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace AwsLabs::Enhanced::Detail {
+// Aws::String is std::string unless the SDK was built with -DCUSTOM_MEMORY_MANAGEMENT=ON, which gives it the
+// SDK allocator. These convert between the two, returning the argument itself when the types are the same, so
+// results are only meant to be passed on, not kept by reference.
+template<typename To, typename From>
+decltype(auto) convertString(From const &s) {
+  if constexpr (std::is_same_v<To, From>)
+    return (s);
+  else
+    return To(s.data(), s.size());
+}
+
+inline decltype(auto) toAwsString(std::string const &s) {
+  return convertString<Aws::String>(s);
+}
+
+inline decltype(auto) toStdString(Aws::String const &s) {
+  return convertString<std::string>(s);
+}
+}
@@ -1,4 +1,20 @@
 #pragma once
+#include <aws/core/utils/memory/stl/AWSString.h>
+#include "aws_string.h"
+#include <alpaca/alpaca.h>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <vector>
 
 namespace AwsLabs::Enhanced::Detail {
 template<typename ...Ts>
@@ -17,4 +33,354 @@ struct ResultHolder {
     explicit ResultHolder(T const &result) : result(result) {}
 };
 
-}
\ No newline at end of file
+// Buffer of the calling thread for serialized bytes, reused across calls
+inline std::vector<uint8_t> &codecBuffer() {
+  static thread_local std::vector<uint8_t> buffer;
+  return buffer;
+}
+
+// Keeps the buffer's capacity unless a large payload grew it
+inline void releaseCodecBuffer(std::vector<uint8_t> &buffer) {
+  constexpr std::size_t retained = 1024 * 1024;
+  if (buffer.capacity() > retained)
+    std::vector<uint8_t>().swap(buffer);
+}
+
+inline constexpr char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Character values, -1 for characters outside the alphabet
+inline constexpr auto base64Values = [] {
+  std::array<int8_t, 256> values{};
+  values.fill(-1);
+  for (int i = 0; i < 64; ++i)
+    values[static_cast<unsigned char>(base64Alphabet[i])] = static_cast<int8_t>(i);
+  return values;
+}();
+
+// Appends the padded base64 of n bytes, with branch free table lookups over whole groups
+inline void base64Encode(uint8_t const *in, std::size_t n, Aws::String &out) {
+  auto start = out.size();
+  out.resize(start + (n + 2) / 3 * 4);
+  auto o = out.data() + start;
+  std::size_t i = 0;
+  for (; i + 3 <= n; i += 3, o += 4) {
+    uint32_t v = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8 | in[i + 2];
+    o[0] = base64Alphabet[v >> 18];
+    o[1] = base64Alphabet[v >> 12 & 63];
+    o[2] = base64Alphabet[v >> 6 & 63];
+    o[3] = base64Alphabet[v & 63];
+  }
+  if (i < n) {
+    uint32_t v = uint32_t(in[i]) << 16 | (i + 1 < n ? uint32_t(in[i + 1]) << 8 : 0);
+    o[0] = base64Alphabet[v >> 18];
+    o[1] = base64Alphabet[v >> 12 & 63];
+    o[2] = i + 1 < n ? base64Alphabet[v >> 6 & 63] : '=';
+    o[3] = '=';
+  }
+}
+
+// Replaces out with the bytes of padded base64
+inline void base64Decode(std::string_view in, std::vector<uint8_t> &out) {
+  if (in.size() % 4)
+    throw std::runtime_error("Invalid base64 length");
+  std::size_t padding = in.empty() ? 0 : (in.back() == '=') + (in.size() > 1 && in[in.size() - 2] == '=');
+  out.resize(in.size() / 4 * 3 - padding);
+  auto o = out.data();
+  int32_t invalid = 0;
+  std::size_t i = 0;
+  auto value = [&](char c) { return int32_t(base64Values[static_cast<unsigned char>(c)]); };
+  for (auto whole = padding ? in.size() - 4 : in.size(); i < whole; i += 4, o += 3) {
+    int32_t v = value(in[i]) << 18 | value(in[i + 1]) << 12 | value(in[i + 2]) << 6 | value(in[i + 3]);
+    invalid |= v; // negative when any character was outside the alphabet
+    o[0] = uint8_t(v >> 16);
+    o[1] = uint8_t(v >> 8);
+    o[2] = uint8_t(v);
+  }
+  if (padding) {
+    int32_t v = value(in[i]) << 18 | value(in[i + 1]) << 12 | (padding == 1 ? value(in[i + 2]) << 6 : 0);
+    invalid |= v;
+    o[0] = uint8_t(v >> 16);
+    if (padding == 1)
+      o[1] = uint8_t(v >> 8);
+  }
+  if (invalid < 0)
+    throw std::runtime_error("Invalid base64 character");
+}
+
+// Types copied byte for byte: trivially copyable values, excluding pointers that mean nothing in another process
+template<typename T>
+inline constexpr bool isFlat = std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>
+                               && !std::is_pointer_v<T> && !std::is_member_pointer_v<T>;
+
+// Holders of flat types are encoded as a FlatHeader followed by their values in order, in native byte order
+template<typename Holder>
+struct FlatLayout {
+  static constexpr bool flat = false;
+};
+
+template<typename T>
+constexpr std::size_t kind() {
+  return std::is_floating_point_v<T> ? 1 : std::is_signed_v<T> ? 2 : std::is_integral_v<T> ? 3 : std::is_enum_v<T> ? 4 : 5;
+}
+
+// T as spelled by the compiler, e.g. "ns::Point"
+template<typename T>
+constexpr std::string_view typeName() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  std::string_view name = __FUNCSIG__;
+  auto start = name.find("typeName<") + 9;
+  return name.substr(start, name.rfind(">(void)") - start);
+#else
+  std::string_view name = __PRETTY_FUNCTION__;
+  auto start = name.find("T = ") + 4;
+  auto end = name.find(';', start);
+  return name.substr(start, (end == std::string_view::npos ? name.rfind(']') : end) - start);
+#endif
+}
+
+constexpr uint32_t fnv1a(uint32_t hash, std::size_t value) {
+  return (hash ^ uint32_t(value)) * 16777619u;
+}
+
+// Hashes name without spaces and standard library inline namespaces, which compilers spell differently
+constexpr uint32_t fnv1aName(uint32_t hash, std::string_view name) {
+  for (std::size_t i = 0; i < name.size(); ++i) {
+    auto rest = name.substr(i);
+    if (rest.starts_with("__cxx11::"))
+      i += 8;
+    else if (rest.starts_with("__1::"))
+      i += 4;
+    else if (name[i] != ' ')
+      hash = fnv1a(hash, uint8_t(name[i]));
+  }
+  return hash;
+}
+
+// Arithmetic types by kind and size, as compilers spell e.g. long as "long" or "long int", others by name,
+// with the size and alignment of flat ones
+template<typename T>
+constexpr uint32_t fnv1aType(uint32_t hash) {
+  if constexpr (std::is_arithmetic_v<T>)
+    return fnv1a(fnv1a(hash, kind<T>()), sizeof(T));
+  else if constexpr (isFlat<T>)
+    return fnv1a(fnv1a(fnv1aName(hash, typeName<T>()), sizeof(T)), alignof(T));
+  else
+    return fnv1aName(hash, typeName<T>());
+}
+
+template<typename ...Ts>
+struct FlatLayout<ArgsHolder<Ts...>> {
+  static constexpr bool flat = (isFlat<Ts> && ...);
+  static constexpr std::size_t count = sizeof...(Ts);
+  static constexpr std::size_t size = (sizeof(Ts) + ... + 0);
+  // FNV-1a of the types, so both sides detect different types. Members are not seen: a struct changed
+  // under the same name is only detected when its size or alignment changed.
+  static constexpr uint32_t layout = [] {
+    uint32_t hash = 2166136261u;
+    ((hash = fnv1aType<Ts>(hash)), ...);
+    return hash;
+  }();
+
+  template<typename Holder, typename F>
+  static void forEach(Holder &holder, F f) {
+    std::apply([&](auto &...values) { (f(values), ...); }, holder.tup);
+  }
+};
+
+template<typename T>
+struct FlatLayout<ResultHolder<T>> : FlatLayout<ArgsHolder<T>> {
+  template<typename Holder, typename F>
+  static void forEach(Holder &holder, F f) {
+    f(holder.result);
+  }
+};
+
+struct FlatHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t size;
+  uint32_t layout;
+};
+
+// Reads as "ALFT" in little endian memory, so a peer of the other byte order sees no flat encoding
+inline constexpr uint32_t flatMagic = 0x54464c41;
+inline constexpr uint16_t flatVersion = 1;
+
+// Identifies a function hosted with others in one deployment: FNV-1a of its name and of the types of its
+// signature. Sizes only count for flat types, since standard library classes differ in size between the
+// client and the handler. Type names are as the compiler spells them, so a client and a handler built with
+// different compilers may get different IDs for one signature, failing rather than misreading the payload.
+template<typename Sig>
+struct FunctionId;
+
+template<typename R, typename ...Args>
+struct FunctionId<R(Args...)> {
+  static constexpr uint32_t of(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name)
+      hash = fnv1a(hash, uint8_t(c));
+    hash = fnv1aType<std::decay_t<R>>(fnv1a(hash, sizeof...(Args)));
+    ((hash = fnv1aType<std::decay_t<Args>>(hash)), ...);
+    return hash;
+  }
+};
+
+template<typename Sig>
+constexpr uint32_t functionId(std::string_view name) {
+  return FunctionId<Sig>::of(name);
+}
+
+template<typename Holder>
+std::size_t flatSerialize(Holder const &holder, std::vector<uint8_t> &bytes) {
+  using Layout = FlatLayout<Holder>;
+  FlatHeader header{flatMagic, flatVersion, uint16_t(Layout::count), uint32_t(Layout::size), Layout::layout};
+  bytes.resize(sizeof(header) + Layout::size);
+  std::memcpy(bytes.data(), &header, sizeof(header));
+  auto offset = sizeof(header);
+  Layout::forEach(holder, [&](auto const &value) {
+    std::memcpy(bytes.data() + offset, &value, sizeof(value));
+    offset += sizeof(value);
+  });
+  return bytes.size();
+}
+
+// Whether bytes hold a flat encoding, throwing when it does not match Holder
+template<typename Holder>
+bool isFlatEncoding(std::vector<uint8_t> const &bytes) {
+  using Layout = FlatLayout<Holder>;
+  FlatHeader header;
+  if (bytes.size() < sizeof(header))
+    return false;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (header.magic != flatMagic)
+    return false;
+  if (header.version != flatVersion)
+    throw std::runtime_error("Unsupported flat encoding version " + std::to_string(header.version));
+  if (header.count != Layout::count || header.size != Layout::size || header.layout != Layout::layout
+      || bytes.size() != sizeof(header) + Layout::size)
+    throw std::runtime_error("Flat encoding does not match the types of the function, redeploy both sides");
+  return true;
+}
+
+template<typename Holder>
+Holder flatDeserialize(std::vector<uint8_t> const &bytes) {
+  Holder holder;
+  auto offset = sizeof(FlatHeader);
+  FlatLayout<Holder>::forEach(holder, [&](auto &value) {
+    std::memcpy(&value, bytes.data() + offset, sizeof(value));
+    offset += sizeof(value);
+  });
+  return holder;
+}
+
+// Serializes a holder into the buffer of the calling thread. With flat, holders of flat types are copied
+// byte for byte, others always go through alpaca.
+template<typename Holder>
+std::vector<uint8_t> &serialize(Holder const &holder, bool flat = false) {
+  auto &bytes = codecBuffer();
+  bytes.clear();
+  if constexpr (FlatLayout<Holder>::flat) {
+    if (flat) {
+      flatSerialize(holder, bytes);
+      return bytes;
+    }
+  }
+  bytes.resize(alpaca::serialize(holder, bytes));
+  return bytes;
+}
+
+// Serializes a holder and encodes it as base64 for a JSON payload
+template<typename Holder>
+Aws::String encode(Holder const &holder, bool flat = false) {
+  auto &bytes = serialize(holder, flat);
+  Aws::String base64;
+  base64Encode(bytes.data(), bytes.size(), base64);
+  releaseCodecBuffer(bytes);
+  return base64;
+}
+
+// Inverse of serialize, reading both encodings of flat holders. Peers predating the flat encoding cannot read
+// it, so it is only sent to handlers that announced they can, see flatField.
+template<typename Holder>
+Holder decodeBytes(std::vector<uint8_t> &bytes) {
+  if constexpr (FlatLayout<Holder>::flat) {
+    if (isFlatEncoding<Holder>(bytes)) {
+      auto holder = flatDeserialize<Holder>(bytes);
+      releaseCodecBuffer(bytes);
+      return holder;
+    }
+  }
+  std::error_code ec;
+  auto holder = alpaca::deserialize<Holder>(bytes, ec);
+  releaseCodecBuffer(bytes);
+  if(ec)
+    throw std::runtime_error("Deserialization error code: " + ec.message());
+  return holder;
+}
+
+// Inverse of encode
+template<typename Holder>
+Holder decode(std::string_view base64) {
+  auto &bytes = codecBuffer();
+  base64Decode(base64, bytes);
+  return decodeBytes<Holder>(bytes);
+}
+
+// Payload field of prewarm invocations, holding the milliseconds to hold them
+inline constexpr char const *prewarmField = "awslabs_prewarm_ms";
+
+// Payload field of clients sending flat encodings, asking the handler to encode its results the same way
+inline constexpr char const *flatField = "awslabs_flat";
+
+// Payload field of Event invocations, holding the location the handler writes its response to
+inline constexpr char const *eventResultField = "awslabs_event_result";
+
+// Writes {"key":"value"}, for keys and base64 values needing no escapes
+inline void writeCompactJson(std::ostream &os, std::string_view key, std::string_view value) {
+  os << "{\"" << key << "\":\"" << value << "\"}";
+}
+
+// Start of the value of key in a JSON object, past the colon and spaces
+inline std::optional<std::size_t> fieldValue(std::string_view json, std::string_view key) {
+  auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+  for (auto pos = json.find(key); pos != std::string_view::npos; pos = json.find(key, pos + 1)) {
+    auto after = pos + key.size();
+    if (pos == 0 || json[pos - 1] != '"' || after >= json.size() || json[after] != '"')
+      continue;
+    ++after;
+    while (after < json.size() && isSpace(json[after]))
+      ++after;
+    if (after == json.size() || json[after] != ':')
+      continue;
+    ++after;
+    while (after < json.size() && isSpace(json[after]))
+      ++after;
+    return after;
+  }
+  return std::nullopt;
+}
+
+// The string value of key without escapes, e.g. base64, found without parsing the whole payload
+inline std::optional<std::string_view> stringField(std::string_view json, std::string_view key) {
+  auto start = fieldValue(json, key);
+  if (!start || *start == json.size() || json[*start] != '"')
+    return std::nullopt;
+  auto end = json.find_first_of("\"\\", *start + 1);
+  if (end == std::string_view::npos || json[end] != '"')
+    return std::nullopt;
+  return json.substr(*start + 1, end - *start - 1);
+}
+
+inline std::optional<int64_t> int64Field(std::string_view json, std::string_view key) {
+  auto start = fieldValue(json, key);
+  if (!start)
+    return std::nullopt;
+  int64_t value;
+  auto [end, ec] = std::from_chars(json.data() + *start, json.data() + json.size(), value);
+  if (ec != std::errc())
+    return std::nullopt;
+  return value;
+}
+
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include <aws/core/utils/UUID.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/model/DeleteObjectRequest.h>
+#include <awslabs/enhanced/executor.h>
+#include <awslabs/enhanced/is3stream.h>
+#include <awslabs/enhanced/os3stream.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lambda_detail.h"
+
+namespace AwsLabs::Enhanced {
+// Where arguments and results serialized above threshold bytes go instead of the invocation payload, which
+// Lambda caps at 6MB. Handlers only read argument objects, so retried and re-delivered invocations still find
+// them, and the client deletes them once the response arrived. The client deletes result objects as it reads
+// them. An expiration lifecycle rule on the prefix removes the objects of invocations whose client gave up.
+struct LambdaOffload {
+  std::string region;
+  std::string bucket;
+  std::string prefix = "lambda-offload/";
+  std::size_t threshold = 4 * 1024 * 1024;
+};
+}
+
+// Offloaded values are stored as their raw serialized bytes, without base64, and the payload holds
+// "<key>_s3":"region/bucket/object" in place of "<key>":"<base64>"
+namespace AwsLabs::Enhanced::Detail {
+
+// One client per region, shared by the offload streams
+inline std::shared_ptr<Aws::S3::S3Client> offloadClient(std::string const &region) {
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<Aws::S3::S3Client>> clients;
+  std::lock_guard lock(mutex);
+  auto &client = clients[region];
+  if (!client) {
+    Aws::Client::ClientConfiguration config;
+    config.region = region;
+    config.executor = shared_executor();
+    client = std::make_shared<Aws::S3::S3Client>(config);
+  }
+  return client;
+}
+
+inline std::string formatLocation(s3location const &location) {
+  return location.region + "/" + location.bucket + "/" + location.object;
+}
+
+inline s3location parseLocation(std::string_view text) {
+  auto bucketStart = text.find('/');
+  auto objectStart = bucketStart == std::string_view::npos ? bucketStart : text.find('/', bucketStart + 1);
+  if (objectStart == std::string_view::npos)
+    throw std::runtime_error("Invalid offload location " + std::string(text));
+  std::string region(text.substr(0, bucketStart));
+  std::string bucket(text.substr(bucketStart + 1, objectStart - bucketStart - 1));
+  std::string object(text.substr(objectStart + 1));
+  return s3location(region.c_str(), bucket.c_str(), object.c_str());
+}
+
+inline s3location newOffloadObject(LambdaOffload const &target) {
+  auto object = target.prefix + std::string(Aws::Utils::UUID::RandomUUID().c_str());
+  return s3location(target.region.c_str(), target.bucket.c_str(), object.c_str());
+}
+
+inline void writeOffloaded(s3location const &location, std::vector<uint8_t> const &bytes) {
+  os3stream out;
+  out.rdbuf()->set_client(offloadClient(location.region));
+  out.open(location.region, location.bucket, location.object);
+  out.write(reinterpret_cast<char const *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  out.close();
+  if (!out)
+    throw std::runtime_error("Cannot write offloaded payload to " + formatLocation(location));
+}
+
+inline s3location putOffloaded(LambdaOffload const &target, std::vector<uint8_t> const &bytes) {
+  auto location = newOffloadObject(target);
+  writeOffloaded(location, bytes);
+  return location;
+}
+
+inline void deleteOffloaded(s3location const &location) {
+  Aws::S3::Model::DeleteObjectRequest request;
+  request.SetBucket(toAwsString(location.bucket));
+  request.SetKey(toAwsString(location.object));
+  offloadClient(location.region)->DeleteObject(request);
+}
+
+inline void readOffloaded(s3location const &location, std::vector<uint8_t> &bytes) {
+  is3stream in;
+  in.rdbuf()->set_client(offloadClient(location.region));
+  in.open(location.region, location.bucket, location.object);
+  if (!in)
+    throw std::runtime_error("Cannot read offloaded payload from " + formatLocation(location));
+  bytes.clear();
+  constexpr std::size_t chunk = 1024 * 1024;
+  for (;;) {
+    auto size = bytes.size();
+    bytes.resize(size + chunk);
+    in.read(reinterpret_cast<char *>(bytes.data() + size), chunk);
+    bytes.resize(size + static_cast<std::size_t>(in.gcount()));
+    if (!in)
+      break;
+  }
+  in.close();
+}
+
+// Reads the object into bytes and deletes it
+inline void takeOffloaded(s3location const &location, std::vector<uint8_t> &bytes) {
+  readOffloaded(location, bytes);
+  deleteOffloaded(location);
+}
+
+// Deletes the offloaded arguments of an invocation, if any, once its response arrived
+inline void deleteArgument(std::optional<s3location> const &argument) {
+  if (argument)
+    deleteOffloaded(*argument);
+}
+
+// The value of key in a payload, inline as base64 or offloaded. An offloaded object is deleted once read
+// with take, which only the client does, for results.
+template<typename Holder>
+std::optional<Holder> decodeField(std::string_view payload, std::string_view key, bool take = false) {
+  if (auto base64 = stringField(payload, key))
+    return decode<Holder>(*base64);
+  auto offloadKey = std::string(key) + "_s3";
+  auto location = stringField(payload, offloadKey);
+  if (!location)
+    return std::nullopt;
+  auto &bytes = codecBuffer();
+  if (take)
+    takeOffloaded(parseLocation(*location), bytes);
+  else
+    readOffloaded(parseLocation(*location), bytes);
+  return decodeBytes<Holder>(bytes);
+}
+
+// "key":"<base64>", or "key_s3":"<location>" when the serialized holder is above the threshold of target
+template<typename Holder>
+std::string encodeField(std::string_view key, Holder const &holder, LambdaOffload const *target, bool flat = false) {
+  auto &bytes = serialize(holder, flat);
+  std::string field = "\"" + std::string(key);
+  if (target && bytes.size() > target->threshold) {
+    field += "_s3\":\"" + formatLocation(putOffloaded(*target, bytes)) + "\"";
+  } else {
+    Aws::String base64;
+    base64Encode(bytes.data(), bytes.size(), base64);
+    field.append("\":\"").append(base64).append("\"");
+  }
+  releaseCodecBuffer(bytes);
+  return field;
+}
+
+// Payload field asking the handler to offload its results to target
+inline std::string offloadRequestField(LambdaOffload const &target) {
+  return "\"offload\":\"" + target.region + "/" + target.bucket + "/" + target.prefix
+         + "\",\"offload_threshold\":" + std::to_string(target.threshold);
+}
+
+inline std::optional<LambdaOffload> offloadRequested(std::string_view payload) {
+  auto target = stringField(payload, "offload");
+  if (!target)
+    return std::nullopt;
+  auto location = parseLocation(*target);
+  return LambdaOffload{location.region, location.bucket, location.object,
+                       static_cast<std::size_t>(int64Field(payload, "offload_threshold").value_or(0))};
+}
+}
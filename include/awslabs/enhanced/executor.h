@@ -0,0 +1,241 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/core/utils/threading/Executor.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace AwsLabs::Enhanced {
+
+struct executor_options {
+  /**
+   * Number of worker threads. SDK asynchronous calls hold a worker for the whole request,
+   * so this also bounds the number of concurrent asynchronous requests.
+   */
+  std::size_t threads = std::max(64u, 8 * std::thread::hardware_concurrency());
+  /**
+   * CPUs the workers are pinned to, worker i runs on cpus[i % cpus.size()]. Empty means no pinning.
+   * Only honored on Linux.
+   */
+  std::vector<int> cpus;
+};
+
+/**
+ * Fixed size thread pool implementing the SDK executor interface.
+ * Every worker owns a queue. Tasks submitted from a worker go to its own queue and are run last in first out,
+ * other tasks are spread round robin, and idle workers steal the oldest tasks from the other queues.
+ * The destructor runs the tasks still queued before joining the workers.
+ */
+class work_stealing_executor : public Aws::Utils::Threading::Executor {
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<worker_queue>> _queues;
+  std::vector<std::thread> _workers;
+  std::atomic<std::size_t> _next = 0;
+  std::atomic<std::size_t> _steals = 0;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::size_t _pending = 0;
+  bool _stop = false;
+
+  static inline thread_local work_stealing_executor *current_executor = nullptr;
+  static inline thread_local std::size_t current_worker = 0;
+
+  bool take(std::size_t worker, std::function<void()> &task) {
+    {
+      auto &own = *_queues[worker];
+      std::lock_guard lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (std::size_t i = 1; i < _queues.size(); ++i) {
+      auto &victim = *_queues[(worker + i) % _queues.size()];
+      std::lock_guard lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        ++_steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(std::size_t worker) {
+    current_executor = this;
+    current_worker = worker;
+    std::function<void()> task;
+    while (true) {
+      if (take(worker, task)) {
+        {
+          std::lock_guard lock(_mutex);
+          --_pending;
+        }
+        task();
+        task = nullptr;
+        continue;
+      }
+      std::unique_lock lock(_mutex);
+      _cv.wait(lock, [&] { return _stop || _pending; });
+      if (_stop && !_pending) {
+        return;
+      }
+    }
+  }
+
+  static void pin(std::thread &thread, int cpu) {
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#endif
+  }
+
+protected:
+  bool SubmitToThread(std::function<void()> &&task) override {
+    auto queue = current_executor == this ? current_worker : _next++ % _queues.size();
+    {
+      // Counted before it is queued, so no worker can take it and decrement _pending first
+      std::lock_guard lock(_mutex);
+      if (_stop) {
+        return false;
+      }
+      ++_pending;
+    }
+    {
+      std::lock_guard lock(_queues[queue]->mutex);
+      _queues[queue]->tasks.push_back(std::move(task));
+    }
+    _cv.notify_one();
+    return true;
+  }
+
+public:
+  explicit work_stealing_executor(const executor_options &options = {}) {
+    auto threads = std::max<std::size_t>(1, options.threads);
+    for (std::size_t i = 0; i < threads; ++i) {
+      _queues.push_back(std::make_unique<worker_queue>());
+    }
+    for (std::size_t i = 0; i < threads; ++i) {
+      _workers.emplace_back([this, i] { run(i); });
+      if (!options.cpus.empty()) {
+        pin(_workers.back(), options.cpus[i % options.cpus.size()]);
+      }
+    }
+  }
+
+  work_stealing_executor(const work_stealing_executor &) = delete;
+  work_stealing_executor &operator=(const work_stealing_executor &) = delete;
+
+  ~work_stealing_executor() override {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto &worker : _workers) {
+      if (worker.get_id() == std::this_thread::get_id()) {
+        worker.detach(); // destroyed from one of its own tasks
+      } else {
+        worker.join();
+      }
+    }
+  }
+
+  /**
+   * Number of worker threads.
+   * @return
+   */
+  std::size_t threads() const {
+    return _workers.size();
+  }
+
+  /**
+   * Number of tasks run by a worker other than the one they were queued to.
+   * @return
+   */
+  std::size_t steals() const {
+    return _steals;
+  }
+};
+
+namespace Detail {
+struct shared_executor_state {
+  std::mutex mutex;
+  executor_options options;
+  std::shared_ptr<work_stealing_executor> executor;
+};
+
+inline shared_executor_state &shared_executor_state_instance() {
+  static shared_executor_state state;
+  return state;
+}
+}
+
+/**
+ * Sets the options of the executor shared by the enhanced clients. Clients created before keep the
+ * executor they were created with, later ones get a new executor with these options.
+ * @param options
+ */
+inline void configure_shared_executor(const executor_options &options) {
+  auto &state = Detail::shared_executor_state_instance();
+  std::lock_guard lock(state.mutex);
+  state.options = options;
+  state.executor = nullptr;
+}
+
+/**
+ * The options of the shared executor, for clients creating an executor of their own.
+ * @return
+ */
+inline executor_options shared_executor_options() {
+  auto &state = Detail::shared_executor_state_instance();
+  std::lock_guard lock(state.mutex);
+  return state.options;
+}
+
+/**
+ * The executor running the asynchronous calls of the enhanced clients, created on first use.
+ * @return
+ */
+inline std::shared_ptr<work_stealing_executor> shared_executor() {
+  auto &state = Detail::shared_executor_state_instance();
+  std::lock_guard lock(state.mutex);
+  if (!state.executor) {
+    state.executor = std::make_shared<work_stealing_executor>(state.options);
+  }
+  return state.executor;
+}
+
+/**
+ * Releases the shared executor. Its workers stop once the last client using it is destroyed.
+ */
+inline void release_shared_executor() {
+  auto &state = Detail::shared_executor_state_instance();
+  std::lock_guard lock(state.mutex);
+  state.executor = nullptr;
+}
+}
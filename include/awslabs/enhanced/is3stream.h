@@ -18,8 +18,8 @@ protected:
   /**
    * Opens the current region/bucket/object and set the iostate
   */
-  void open(std::ios_base::openmode mode = std::ios_base::in) {
-    if(_s3b->open(_region, _bucket_name, _object_name, mode))
+  void open(s3open_policy policy = s3open_policy::eager, std::ios_base::openmode mode = std::ios_base::in) {
+    if(_s3b->open(_region, _bucket_name, _object_name, mode, policy))
       std::ios::setstate(goodbit);
     else
       std::ios::setstate(failbit);
@@ -65,17 +65,23 @@ public:
   }
   /**
    * Construct an is3stream and opens the target object for reading.
+   * With s3open_policy::lazy the object is requested on the first read, with s3open_policy::async
+   * the request is started without waiting for its response.
    * @param region
    * @param bucket_name
    * @param object_name
+   * @param policy
    */
-  is3stream(const std::string &region, const std::string &bucket_name, const std::string &object_name)
+  is3stream(const std::string &region,
+            const std::string &bucket_name,
+            const std::string &object_name,
+            s3open_policy policy = s3open_policy::eager)
       : std::istream(new s3buf()) {
     _s3b = dynamic_cast<s3buf *>(std::istream::rdbuf());
     _region = region;
     _bucket_name = bucket_name;
     _object_name = object_name;
-    open();
+    open(policy);
   }
 
   /**
@@ -113,6 +119,49 @@ public:
     _object_name = object_name;
     open();
   }
+  /**
+   * Opens object_name in region and bucket_name, deciding with policy when the object is requested.
+   * @param region
+   * @param bucket_name
+   * @param object_name
+   * @param policy
+   */
+  void open(const std::string &region,
+            const std::string &bucket_name,
+            const std::string &object_name,
+            s3open_policy policy) {
+    _region = region;
+    _bucket_name = bucket_name;
+    _object_name = object_name;
+    open(policy);
+  }
+  /**
+   * Starts retrieving object_name in previously set region and bucket and returns without waiting.
+   * Opening many objects this way overlaps their request latencies.
+   * @param object_name
+   */
+  void async_open(const std::string &object_name) {
+    _object_name = object_name;
+    open(s3open_policy::async);
+  }
+  /**
+   * Starts retrieving object_name in bucket_name and returns without waiting.
+   * @param region
+   * @param bucket_name
+   * @param object_name
+   */
+  void async_open(const std::string &region, const std::string &bucket_name, const std::string &object_name) {
+    open(region, bucket_name, object_name, s3open_policy::async);
+  }
+  /**
+   * Waits until a lazily or asynchronously opened object is retrieved, issuing the request if it was deferred.
+   * Sets failbit if the object could not be retrieved.
+   */
+  void wait_open() {
+    if (!_s3b->wait_open()) {
+      std::ios::setstate(failbit);
+    }
+  }
   /**
    * Returns whether the is3stream is currently associated to an S3 object.
    * @return
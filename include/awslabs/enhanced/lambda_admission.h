@@ -0,0 +1,195 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+struct AdmissionOptions {
+  // Invocations started per second, unlimited when 0, and how many may start at once after an idle period,
+  // a second's worth when 0
+  double rate = 0;
+  double burst = 0;
+  // Share of the concurrency limit kept after a throttled invocation
+  double decrease = 0.9;
+  // Throttled invocations are retried up to maxRetries times, each after a random delay of up to
+  // min(maxBackoff, baseBackoff * 2^retry)
+  std::size_t maxRetries = 10;
+  std::chrono::milliseconds baseBackoff{20};
+  std::chrono::milliseconds maxBackoff{2000};
+};
+
+/**
+ * Queues calls and starts them in order while a token of the bucket and a slot under the concurrency limit
+ * are available. The limit grows by one per limit calls completing and shrinks by the decrease factor when a
+ * call is throttled, at most once per window of calls started after the previous decrease, so a burst of 429
+ * responses lowers it only once and the limit settles just under the concurrency Lambda grants. Calls still
+ * queued when the controller is destroyed are started with the ticket cancelled, which they must not finish.
+ */
+class AdmissionController {
+public:
+  using Clock = std::chrono::steady_clock;
+  // Started with a ticket that must be passed to finish once the call completes
+  using Start = std::function<void(std::size_t ticket)>;
+  static constexpr std::size_t cancelled = std::numeric_limits<std::size_t>::max();
+
+  struct Statistics {
+    double limit = 0;
+    std::size_t inFlight = 0;
+    std::size_t queued = 0;
+    std::size_t throttled = 0;
+  };
+
+  AdmissionController(AdmissionOptions options, std::size_t ceiling)
+      : options(options), ceiling(std::max<std::size_t>(ceiling, 1)), limit(double(this->ceiling)),
+        tokens(bucketSize()), refilled(Clock::now()), random(std::random_device()()) {
+    dispatcher = std::thread([this] { run(); });
+  }
+
+  ~AdmissionController() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    dispatcher.join();
+    for (auto &start : ready)
+      start(cancelled);
+    for (auto &[at, start] : delayed)
+      start(cancelled);
+  }
+
+  AdmissionController(AdmissionController const &) = delete;
+  AdmissionController &operator=(AdmissionController const &) = delete;
+
+  // Queues start, to be started no earlier than at
+  void submit(Start start, Clock::time_point at = Clock::now()) {
+    {
+      std::lock_guard lock(mutex);
+      if (at <= Clock::now())
+        ready.push_back(std::move(start));
+      else
+        delayed.emplace(at, std::move(start));
+    }
+    cv.notify_all();
+  }
+
+  void finish(std::size_t ticket, bool throttled) {
+    {
+      std::lock_guard lock(mutex);
+      --inFlight;
+      if (throttled) {
+        ++statistics.throttled;
+        if (ticket >= window) {
+          limit = std::max(1.0, limit * options.decrease);
+          window = nextTicket;
+        }
+      } else {
+        limit = std::min(double(ceiling), limit + 1 / limit);
+      }
+    }
+    cv.notify_all();
+  }
+
+  // Delay before retry, counting from 0, with full jitter so throttled calls do not return together
+  std::chrono::milliseconds backoff(std::size_t retry) {
+    auto cap = std::min<double>(double(options.maxBackoff.count()),
+                                double(options.baseBackoff.count()) * double(1ull << std::min<std::size_t>(retry, 30)));
+    std::lock_guard lock(mutex);
+    return std::chrono::milliseconds(
+      static_cast<long long>(std::uniform_real_distribution<double>(0, cap)(random)));
+  }
+
+  std::size_t maxRetries() const { return options.maxRetries; }
+
+  Statistics stats() {
+    std::lock_guard lock(mutex);
+    auto s = statistics;
+    s.limit = limit;
+    s.inFlight = inFlight;
+    s.queued = ready.size() + delayed.size();
+    return s;
+  }
+
+private:
+  double bucketSize() const { return options.burst > 0 ? options.burst : std::max(1.0, options.rate); }
+
+  void refill(Clock::time_point now) {
+    if (options.rate <= 0)
+      return;
+    tokens = std::min(bucketSize(), tokens + std::chrono::duration<double>(now - refilled).count() * options.rate);
+    refilled = now;
+  }
+
+  void run() {
+    std::unique_lock lock(mutex);
+    while (!stopping) {
+      auto now = Clock::now();
+      refill(now);
+      while (!delayed.empty() && delayed.begin()->first <= now) {
+        ready.push_back(std::move(delayed.begin()->second));
+        delayed.erase(delayed.begin());
+      }
+      std::vector<std::pair<std::size_t, Start>> starting;
+      while (!ready.empty() && double(inFlight) < std::floor(limit) && (options.rate <= 0 || tokens >= 1)) {
+        if (options.rate > 0)
+          tokens -= 1;
+        ++inFlight;
+        starting.emplace_back(nextTicket++, std::move(ready.front()));
+        ready.pop_front();
+      }
+      if (!starting.empty()) {
+        lock.unlock();
+        for (auto &[ticket, start] : starting)
+          start(ticket);
+        starting.clear();
+        lock.lock();
+        continue;
+      }
+      auto wake = Clock::time_point::max();
+      if (!delayed.empty())
+        wake = delayed.begin()->first;
+      if (!ready.empty() && double(inFlight) < std::floor(limit) && options.rate > 0)
+        wake = std::min(wake, now + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>((1 - tokens) / options.rate)));
+      if (wake == Clock::time_point::max())
+        cv.wait(lock);
+      else
+        cv.wait_until(lock, wake);
+    }
+  }
+
+  AdmissionOptions options;
+  std::size_t ceiling;
+  std::mutex mutex;
+  std::condition_variable cv;
+  double limit;
+  double tokens;
+  Clock::time_point refilled;
+  std::size_t inFlight = 0;
+  std::size_t nextTicket = 0;
+  std::size_t window = 0;
+  std::deque<Start> ready;
+  std::multimap<Clock::time_point, Start> delayed;
+  std::mt19937 random;
+  Statistics statistics;
+  bool stopping = false;
+  std::thread dispatcher;
+};
+}
@@ -0,0 +1,203 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/core/utils/HashingUtils.h>
+#include <aws/core/utils/stream/PreallocatedStreamBuf.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <cstdlib>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include "detail/lambda_offload.h"
+
+namespace AwsLabs::Enhanced {
+namespace Detail {
+template<typename T>
+std::shared_ptr<T const> broadcastValue(std::string const &location);
+}
+
+// A read only argument, e.g. a model or a lookup table, passed to many invocations. It is uploaded once by
+// broadcast and invocations carry only its location. Containers fetch it on first use and keep it in memory
+// across invocations, up to the capacity of the BroadcastCache, so get() is only slow the first time a warm
+// container sees it. Hold what get() returns while using the value, which may be evicted from the cache.
+template<typename T>
+struct Broadcast {
+  std::string location;
+
+  std::shared_ptr<T const> get() const { return Detail::broadcastValue<T>(location); }
+
+  // Keeps the value for the expression, e.g. model->predict(x)
+  std::shared_ptr<T const> operator->() const { return get(); }
+};
+
+namespace Detail {
+template<typename T>
+struct IsBroadcast : std::false_type {};
+
+template<typename T>
+struct IsBroadcast<Broadcast<T>> : std::true_type {};
+
+// Whether a handler taking Args fetches broadcast values and needs the SDK
+template<typename ...Args>
+constexpr bool takesBroadcast = (IsBroadcast<std::decay_t<Args>>::value || ...);
+
+// Values by location and type, least recently used first evicted once their serialized sizes exceed the
+// capacity. Evicted values live on while held. Concurrent first uses wait for a single fetch, and a failed
+// fetch is retried by the next use.
+class BroadcastCache {
+public:
+  static BroadcastCache &instance() {
+    static auto *cache = new BroadcastCache; // never destroyed, values may outlive static destruction
+    return *cache;
+  }
+
+  // Half of the function's memory in Lambda, 1GiB elsewhere
+  static std::size_t defaultCapacity() {
+    auto megabytes = std::getenv("AWS_LAMBDA_FUNCTION_MEMORY_SIZE");
+    std::size_t size = megabytes ? std::strtoull(megabytes, nullptr, 10) : 0;
+    return size ? size * 1024 * 1024 / 2 : std::size_t(1) << 30;
+  }
+
+  void setCapacity(std::size_t bytes) {
+    std::lock_guard lock(mutex);
+    capacity = bytes;
+    evict();
+  }
+
+  // fetch returns the value and its serialized size
+  template<typename T, typename Fetch>
+  std::shared_ptr<T const> get(std::string const &location, Fetch fetch) {
+    auto key = location + '\0' + typeid(T).name();
+    std::promise<std::shared_ptr<void const>> promise;
+    std::shared_future<std::shared_ptr<void const>> value;
+    bool first = false;
+    {
+      std::lock_guard lock(mutex);
+      auto [entry, inserted] = values.try_emplace(key);
+      if (inserted) {
+        entry->second.value = promise.get_future().share();
+        entry->second.use = recent.end();
+      } else if (entry->second.use != recent.end()) {
+        recent.splice(recent.begin(), recent, entry->second.use);
+      }
+      value = entry->second.value;
+      first = inserted;
+    }
+    if (first) {
+      try {
+        auto [fetched, bytes] = fetch();
+        promise.set_value(std::move(fetched));
+        std::lock_guard lock(mutex);
+        cached(key, bytes);
+      } catch (...) {
+        promise.set_exception(std::current_exception());
+        std::lock_guard lock(mutex);
+        values.erase(key);
+      }
+    }
+    return std::static_pointer_cast<T const>(value.get());
+  }
+
+  template<typename T>
+  void put(std::string const &location, std::shared_ptr<T const> value, std::size_t bytes) {
+    auto key = location + '\0' + typeid(T).name();
+    std::promise<std::shared_ptr<void const>> promise;
+    promise.set_value(std::move(value));
+    std::lock_guard lock(mutex);
+    auto [entry, inserted] = values.try_emplace(key);
+    if (!inserted)
+      return;
+    entry->second.value = promise.get_future().share();
+    cached(key, bytes);
+  }
+
+private:
+  struct Entry {
+    std::shared_future<std::shared_ptr<void const>> value;
+    std::size_t bytes = 0;
+    std::list<std::string>::iterator use; // in recent once the value is there
+  };
+
+  void cached(std::string const &key, std::size_t bytes) {
+    auto &entry = values.at(key);
+    entry.bytes = bytes;
+    entry.use = recent.insert(recent.begin(), key);
+    used += bytes;
+    evict();
+  }
+
+  // Keeps the most recent value, even alone above the capacity
+  void evict() {
+    while (used > capacity && recent.size() > 1) {
+      auto found = values.find(recent.back());
+      used -= found->second.bytes;
+      values.erase(found);
+      recent.pop_back();
+    }
+  }
+
+  std::mutex mutex;
+  std::map<std::string, Entry> values;
+  std::list<std::string> recent; // keys of the values there, most recently used first
+  std::size_t used = 0;
+  std::size_t capacity = defaultCapacity();
+};
+
+template<typename T>
+std::shared_ptr<T const> broadcastValue(std::string const &location) {
+  return BroadcastCache::instance().get<T>(location, [&] {
+    auto &bytes = codecBuffer();
+    readOffloaded(parseLocation(location), bytes);
+    auto size = bytes.size();
+    return std::pair(std::make_shared<T const>(decodeBytes<ResultHolder<T>>(bytes).result), size);
+  });
+}
+
+inline bool offloadedExists(s3location const &location) {
+  Aws::S3::Model::HeadObjectRequest request;
+  request.SetBucket(toAwsString(location.bucket));
+  request.SetKey(toAwsString(location.object));
+  return offloadClient(location.region)->HeadObject(request).IsSuccess();
+}
+
+inline Aws::String sha256Hex(std::vector<uint8_t> &bytes) {
+  Aws::Utils::Stream::PreallocatedStreamBuf buffer(bytes.data(), bytes.size());
+  Aws::IOStream stream(&buffer);
+  return Aws::Utils::HashingUtils::HexEncode(Aws::Utils::HashingUtils::CalculateSHA256(stream));
+}
+}
+
+/**
+ * Uploads value under prefix + "broadcast/" + the SHA-256 of its serialized bytes in target, unless an
+ * identical value is already there, and returns the argument referring to it. Broadcast objects are not
+ * deleted after reading; broadcast again after they may have expired from the prefix.
+ * @param target
+ * @param value
+ * @param keepLocal also keeps a copy of value in the BroadcastCache of this process, so local calls, e.g. of
+ * a hybrid transform, use it without downloading it
+ * @return
+ */
+template<typename T>
+Broadcast<T> broadcast(LambdaOffload const &target, T const &value, bool keepLocal = false) {
+  auto &bytes = Detail::serialize(Detail::ResultHolder<T>(value));
+  auto object = target.prefix + "broadcast/" + std::string(Detail::sha256Hex(bytes).c_str());
+  s3location location(target.region.c_str(), target.bucket.c_str(), object.c_str());
+  if (!Detail::offloadedExists(location))
+    Detail::writeOffloaded(location, bytes);
+  auto size = bytes.size();
+  Detail::releaseCodecBuffer(bytes);
+  Broadcast<T> result{Detail::formatLocation(location)};
+  if (keepLocal)
+    Detail::BroadcastCache::instance().put(result.location, std::make_shared<T const>(value), size);
+  return result;
+}
+}
@@ -8,18 +8,37 @@
 #include<memory>
 #include <aws/lambda/LambdaClient.h>
 #include <aws/lambda/model/InvokeRequest.h>
+#include <aws/lambda/model/GetAccountSettingsRequest.h>
 #include <aws/core/Aws.h>
+#include <aws/core/client/DefaultRetryStrategy.h>
+#include <aws/core/client/RetryStrategy.h>
 #include <aws/core/utils/Array.h>
 #include <aws/core/utils/base64/Base64.h>
 #include <aws/core/utils/HashingUtils.h>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <iostream>
 #include <utility>
 #include <future>
 #include <iterator>
 #include <tuple>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <thread>
 #include "detail/lambda_detail.h"
+#include "detail/lambda_offload.h"
+#include "lambda_admission.h"
+#include "lambda_broadcast.h"
+#include "lambda_telemetry.h"
+#include "executor.h"
 
 #include <alpaca/alpaca.h>
 #ifdef __cpp_lib_expected
@@ -32,6 +51,10 @@ namespace expns = tl;
 using Aws::Utils::Json::JsonValue;
 using namespace std::string_literals;
 #define BIND_AWS_LAMBDA(client, f, name) client.bind_lambda<decltype(f)>(name)
+// Binds the function registered as name in the MultiplexedHandler of a deployment, its ID computed at compile time
+#define BIND_AWS_LAMBDA_FUNCTION(client, f, deployment, name) \
+  client.bind_lambda<decltype(f)>(deployment, \
+    std::integral_constant<uint32_t, AwsLabs::Enhanced::Detail::functionId<decltype(f)>(name)>::value)
 
 namespace alpaca::detail {
 template<typename ...Ts>
@@ -44,6 +67,49 @@ struct EnhancedLambdaClient;
 template<typename Sig>
 struct Lambda;
 
+namespace Detail {
+// Retries like the strategy it wraps except for throttled requests, which the AdmissionController of the
+// client retries once it has lowered its limit
+class NoThrottleRetryStrategy : public Aws::Client::RetryStrategy {
+public:
+  explicit NoThrottleRetryStrategy(std::shared_ptr<Aws::Client::RetryStrategy> inner)
+      : inner(inner ? std::move(inner) : std::make_shared<Aws::Client::DefaultRetryStrategy>()) {}
+
+  static bool throttled(Aws::Client::AWSError<Aws::Client::CoreErrors> const &error) {
+    auto type = error.GetErrorType();
+    return type == Aws::Client::CoreErrors::THROTTLING || type == Aws::Client::CoreErrors::SLOW_DOWN
+           || error.GetResponseCode() == Aws::Http::HttpResponseCode::TOO_MANY_REQUESTS;
+  }
+
+  bool ShouldRetry(Aws::Client::AWSError<Aws::Client::CoreErrors> const &error, long attemptedRetries) const override {
+    return !throttled(error) && inner->ShouldRetry(error, attemptedRetries);
+  }
+
+  long CalculateDelayBeforeNextRetry(Aws::Client::AWSError<Aws::Client::CoreErrors> const &error,
+                                     long attemptedRetries) const override {
+    return inner->CalculateDelayBeforeNextRetry(error, attemptedRetries);
+  }
+
+  long GetMaxAttempts() const override { return inner->GetMaxAttempts(); }
+
+  void GetSendToken() override { inner->GetSendToken(); }
+
+  bool HasSendToken() override { return inner->HasSendToken(); }
+
+  void RequestBookkeeping(Aws::Client::HttpResponseOutcome const &outcome) override {
+    inner->RequestBookkeeping(outcome);
+  }
+
+  void RequestBookkeeping(Aws::Client::HttpResponseOutcome const &outcome,
+                          Aws::Client::AWSError<Aws::Client::CoreErrors> const &lastError) override {
+    inner->RequestBookkeeping(outcome, lastError);
+  }
+
+private:
+  std::shared_ptr<Aws::Client::RetryStrategy> inner;
+};
+}
+
 struct EnhancedLambdaClient {
   EnhancedLambdaClient(Aws::Client::ClientConfiguration config = {}) {
     // Kludge that avoids silent poor concurrency. We want the default maximum
@@ -52,13 +118,164 @@ struct EnhancedLambdaClient {
     // assumption that it got the value by default rather than explicitly.
     // Will create a more completely correct solution in the future.
     if(config.maxConnections == 25) config.maxConnections = 1000;
+    maxInFlight = config.maxConnections;
+    // Likewise, the default executor starts a thread per asynchronous call, so
+    // replace it with the bounded executor shared by the enhanced clients. An
+    // invocation holds a worker for its whole round trip, so the admission
+    // controller keeps at most that many in flight and queues the others
+    // without holding a thread.
+    if(!config.executor || std::dynamic_pointer_cast<Aws::Utils::Threading::DefaultExecutor>(config.executor)) {
+      auto executor = shared_executor();
+      maxInFlight = std::min<std::size_t>(maxInFlight, executor->threads());
+      config.executor = executor;
+    }
+    // Throttles are left to the admission controller, as SDK retries would hold its slots and hide the
+    // throttles it lowers its limit on
+    config.retryStrategy = std::make_shared<Detail::NoThrottleRetryStrategy>(config.retryStrategy);
+    admission = std::make_unique<AdmissionController>(AdmissionOptions(), maxInFlight);
     client = std::make_unique<Aws::Lambda::LambdaClient>(config);
   }
+
+  // Waits for the asynchronous invocations in flight, whose callbacks use the client and its admission
+  ~EnhancedLambdaClient() {
+    std::unique_lock lock(callsMutex);
+    callsDone.wait(lock, [this] { return calls == 0; });
+  }
+
+  EnhancedLambdaClient(EnhancedLambdaClient const &) = delete;
+  EnhancedLambdaClient &operator=(EnhancedLambdaClient const &) = delete;
   template<typename Sig>
   Lambda<Sig> bind_lambda(std::string name) {
     return Lambda<Sig>(*this, name);
   }
+
+  template<typename Sig>
+  Lambda<Sig> bind_lambda(std::string deployment, uint32_t function) {
+    return Lambda<Sig>(*this, deployment, function);
+  }
+
+  // Number of invocations worth keeping in flight: the unreserved concurrency of the account,
+  // bounded by the connections and executor threads of the client. The account is queried once.
+  std::size_t concurrency() {
+    std::call_once(concurrencyQueried, [this] {
+      auto outcome = client->GetAccountSettings(Aws::Lambda::Model::GetAccountSettingsRequest());
+      if (outcome.IsSuccess()) {
+        auto unreserved = outcome.GetResult().GetAccountLimit().GetUnreservedConcurrentExecutions();
+        if (unreserved > 0)
+          maxInFlight = std::min<std::size_t>(maxInFlight, unreserved);
+      }
+      maxInFlight = std::max<std::size_t>(maxInFlight, 1);
+    });
+    return maxInFlight;
+  }
+
+  static bool throttled(Aws::Lambda::Model::InvokeOutcome const &outcome) {
+    if (outcome.IsSuccess())
+      return false;
+    auto type = outcome.GetError().GetErrorType();
+    return type == Aws::Lambda::LambdaErrors::TOO_MANY_REQUESTS || type == Aws::Lambda::LambdaErrors::THROTTLING;
+  }
+
+  // Invokes once admitted, retrying throttled invocations after a backoff, and calls c with the outcome
+  template<typename Callback>
+  void invokeAsync(Aws::Lambda::Model::InvokeRequest const &request, Callback c) {
+    {
+      std::lock_guard lock(callsMutex);
+      ++calls;
+    }
+    admit(request, [this, c](Aws::Lambda::Model::InvokeOutcome outcome) {
+      c(std::move(outcome));
+      // Notified under the lock, as the destructor may return as soon as it sees no calls
+      std::lock_guard lock(callsMutex);
+      if (--calls == 0)
+        callsDone.notify_all();
+    });
+  }
+
+  // Invokes on the calling thread once admitted, retrying throttled invocations after a backoff
+  Aws::Lambda::Model::InvokeOutcome invoke(Aws::Lambda::Model::InvokeRequest const &request) {
+    if (!admission)
+      return client->Invoke(request);
+    for (std::size_t retry = 0;; ++retry) {
+      std::promise<std::size_t> admitted;
+      auto ticket = admitted.get_future();
+      admission->submit([&admitted](std::size_t t) { admitted.set_value(t); });
+      auto t = ticket.get();
+      if (t == AdmissionController::cancelled)
+        return cancelledOutcome();
+      rewind(request);
+      auto outcome = client->Invoke(request);
+      auto wasThrottled = throttled(outcome);
+      admission->finish(t, wasThrottled);
+      if (!wasThrottled || retry >= admission->maxRetries())
+        return outcome;
+      std::this_thread::sleep_for(admission->backoff(retry));
+    }
+  }
+
+  // Retries send the body again from its start
+  static void rewind(Aws::Lambda::Model::InvokeRequest const &request) {
+    if (auto body = request.GetBody()) {
+      body->clear();
+      body->seekg(0);
+    }
+  }
+
+  // Outcome of invocations still queued when their admission controller was destroyed
+  static Aws::Lambda::Model::InvokeOutcome cancelledOutcome() {
+    return Aws::Lambda::LambdaError(Aws::Lambda::LambdaErrors::INTERNAL_FAILURE, "Cancelled",
+                                    "The admission controller was destroyed before the invocation started", false);
+  }
+
+  // Queues invocations under a learned concurrency limit and an optional rate, and retries throttled ones.
+  // Replace it to change its options, or reset it to invoke directly, only while no invocation is in flight:
+  // calls it still queues fail, and without it throttled invocations fail as the SDK does not retry them.
+  // Declared before client, so it outlives the SDK callbacks finishing with it.
+  std::unique_ptr<AdmissionController> admission;
   std::unique_ptr <Aws::Lambda::LambdaClient> client;
+  // When set, arguments and results too large for a payload go through S3
+  std::optional<LambdaOffload> offload;
+  // Copies trivially copyable arguments and results byte for byte instead of through alpaca. Only set it
+  // once every handler invoked is built with the flat encoding, as older ones cannot read it.
+  bool flatEncoding = false;
+  // When set, invocations return their log tail, whose REPORT line is recorded here
+  std::shared_ptr<InvocationTelemetry> telemetry;
+  std::size_t maxInFlight;
+  std::once_flag concurrencyQueried;
+
+private:
+  template<typename Callback>
+  void admit(Aws::Lambda::Model::InvokeRequest const &request, Callback c, std::size_t retry = 0) {
+    if (!admission) {
+      client->InvokeAsync(request, [c](const Aws::Lambda::LambdaClient*, const Aws::Lambda::Model::InvokeRequest&,
+                                       Aws::Lambda::Model::InvokeOutcome outcome,
+                                       const std::shared_ptr<const Aws::Client::AsyncCallerContext>&) {
+        c(std::move(outcome));
+      });
+      return;
+    }
+    auto at = retry ? AdmissionController::Clock::now() + admission->backoff(retry - 1)
+                    : AdmissionController::Clock::now();
+    admission->submit([this, request, c, retry](std::size_t ticket) {
+      if (ticket == AdmissionController::cancelled)
+        return c(cancelledOutcome());
+      rewind(request);
+      client->InvokeAsync(request, [this, c, retry, ticket](const Aws::Lambda::LambdaClient*,
+                                                             const Aws::Lambda::Model::InvokeRequest &request,
+                                                             Aws::Lambda::Model::InvokeOutcome outcome,
+                                                             const std::shared_ptr<const Aws::Client::AsyncCallerContext>&) {
+        auto wasThrottled = throttled(outcome);
+        admission->finish(ticket, wasThrottled);
+        if (wasThrottled && retry < admission->maxRetries())
+          return admit(request, c, retry + 1);
+        c(std::move(outcome));
+      });
+    }, at);
+  }
+
+  std::mutex callsMutex;
+  std::condition_variable callsDone;
+  std::size_t calls = 0; // asynchronous invocations whose callback has not returned
 };
 
 
@@ -66,103 +283,336 @@ struct EnhancedLambdaClient {
 template<typename R>
 struct HandleFunctionError {
   R operator()(JsonValue v) {
-    throw std::runtime_error(v.View().GetString("errorMessage"));
+    throw std::runtime_error(v.View().GetString("errorMessage").c_str());
   }
 };
 
 template<typename R>
 struct HandleFunctionError<expns::expected < R, std::string>> {
   expns::expected <R, std::string> operator()(JsonValue v) {
-    return expns::unexpected(v.View().GetString("errorMessage"));
+    return expns::unexpected(Detail::toStdString(v.View().GetString("errorMessage")));
   }
 };
 
 template<typename Sig> struct Lambda;
 
+// Results of a batched invocation, in the order of the argument tuples
+template<typename R>
+struct BatchResult {
+  std::vector<R> results;
+  // Time the function spent running the batch, excluding invocation overhead
+  std::chrono::microseconds computeTime{};
+  // For functions taking a context, the time spent building contexts, e.g. at a cold start, and in the calls
+  // using them
+  std::chrono::microseconds contextInitTime{};
+  std::chrono::microseconds contextTime{};
+};
+
+namespace Detail {
+// Request whose JSON payload holds the encoded arguments under key, written straight into the body.
+// With offload, arguments above its threshold are stored in S3 and the handler is asked to do the same
+// with its results. fields, e.g. ",\"function\":1", are appended to the payload. The object holding offloaded
+// arguments is stored in argument, for the caller to delete once the response arrived.
+inline Aws::Lambda::Model::InvokeRequest makeInvokeRequest(std::string const &name, char const *key, Aws::String const &encoded,
+                                                           LambdaOffload const *offload = nullptr,
+                                                           std::string_view fields = {},
+                                                           std::optional<s3location> *argument = nullptr) {
+  Aws::Lambda::Model::InvokeRequest invokeRequest;
+  invokeRequest.SetFunctionName(toAwsString(name));
+  invokeRequest.SetInvocationType(Aws::Lambda::Model::InvocationType::RequestResponse);
+  std::shared_ptr <Aws::IOStream> payload = Aws::MakeShared<Aws::StringStream>("lambda argument");
+  if (!offload && fields.empty()) {
+    writeCompactJson(*payload, key, encoded);
+  } else {
+    if (offload && encoded.size() / 4 * 3 > offload->threshold) {
+      auto &bytes = codecBuffer();
+      base64Decode(encoded, bytes);
+      auto location = putOffloaded(*offload, bytes);
+      releaseCodecBuffer(bytes);
+      *payload << "{\"" << key << "_s3\":\"" << formatLocation(location) << "\"";
+      if (argument)
+        *argument = location;
+    } else {
+      *payload << "{\"" << key << "\":\"" << encoded << "\"";
+    }
+    if (offload)
+      *payload << "," << offloadRequestField(*offload);
+    *payload << fields << "}";
+  }
+  invokeRequest.SetBody(payload);
+  invokeRequest.SetContentType("application/json");
+  return invokeRequest;
+}
+
+// Invocation that the handler holds for hold and answers without running the function
+inline Aws::Lambda::Model::InvokeRequest makePrewarmRequest(std::string const &name, std::chrono::milliseconds hold,
+                                                            std::string_view fields = {}) {
+  Aws::Lambda::Model::InvokeRequest invokeRequest;
+  invokeRequest.SetFunctionName(toAwsString(name));
+  invokeRequest.SetInvocationType(Aws::Lambda::Model::InvocationType::RequestResponse);
+  std::shared_ptr <Aws::IOStream> payload = Aws::MakeShared<Aws::StringStream>("lambda prewarm");
+  *payload << "{\"" << prewarmField << "\":" << hold.count() << fields << "}";
+  invokeRequest.SetBody(payload);
+  invokeRequest.SetContentType("application/json");
+  return invokeRequest;
+}
+
+// Records the REPORT line of invocations of function when telemetry is collected, and the context times
+// that handlers of functions taking a context append to their responses
+struct Observer {
+  std::shared_ptr<InvocationTelemetry> telemetry;
+  std::string function;
+
+  void operator()(Aws::Lambda::Model::InvokeOutcome &outcome) const {
+    if (!telemetry || !outcome.IsSuccess())
+      return;
+    telemetry->recordLogTail(function, outcome.GetResult().GetLogResult());
+    // The fields close the payload, so only its tail is read before rewinding it for the caller
+    Aws::IOStream &payload = outcome.GetResult().GetPayload();
+    payload.seekg(0, std::ios::end);
+    auto size = static_cast<std::streamoff>(payload.tellg());
+    if (size <= 0) {
+      payload.clear();
+      payload.seekg(0);
+      return;
+    }
+    std::string tail(static_cast<std::size_t>(std::min<std::streamoff>(size, 96)), '\0');
+    payload.seekg(size - static_cast<std::streamoff>(tail.size()));
+    payload.read(tail.data(), static_cast<std::streamsize>(tail.size()));
+    payload.clear();
+    payload.seekg(0);
+    if (auto call = int64Field(tail, "context_us"))
+      telemetry->recordContext(function, int64Field(tail, "context_init_us").value_or(0) / 1000.0, *call / 1000.0);
+  }
+};
+
+inline Aws::String readPayload(Aws::Lambda::Model::InvokeResult &result) {
+  Aws::IOStream &payload = result.GetPayload();
+  // h/t https://stackoverflow.com/questions/3203452/how-to-read-entire-stream-into-a-stdstring
+  return Aws::String(std::istreambuf_iterator<char>(payload), {});
+}
+}
+
 template<typename R, typename ...Args>
 struct Lambda<R(Args...)> {
+  using ArgsTuple = std::tuple<std::decay_t<Args>...>;
+
   Lambda(EnhancedLambdaClient &client, std::string name)
       : client(client), name(name) {}
 
-  static R handleSuccessfulInvocation(Aws::Lambda::Model::InvokeResult &result) {
-    Aws::IOStream &payload = result.GetPayload();
-    // h/t https://stackoverflow.com/questions/3203452/how-to-read-entire-stream-into-a-stdstring
-    Aws::String ret(std::istreambuf_iterator<char>(payload), {});
+  // The function with ID function among those hosted by the deployment name
+  Lambda(EnhancedLambdaClient &client, std::string name, uint32_t function)
+      : client(client), name(name), function(function) {}
 
+  static R handleSuccessfulInvocation(Aws::Lambda::Model::InvokeResult &result) {
+    Aws::String ret = Detail::readPayload(result);
     if (result.GetFunctionError().length())
       return HandleFunctionError<R>{}(ret);
-    JsonValue retAsJson(ret);
-    Aws::Utils::ByteBuffer bb = Aws::Utils::HashingUtils::Base64Decode(retAsJson.View().GetString("value"));
-    static_assert(sizeof(uint8_t) == sizeof(unsigned char), "Platform breaks our assumption that characters are 8 bits");
-    std::vector<uint8_t> bytes(reinterpret_cast<uint8_t *>(bb.GetUnderlyingData()),
-                               reinterpret_cast<uint8_t *>(bb.GetUnderlyingData() + bb.GetLength()));
-    std::error_code ec;
-    auto resultHolder = alpaca::deserialize<Detail::ResultHolder<R>>(bytes, ec);
-    if(ec) 
-      throw std::runtime_error("Deserialization error code: " + ec.message());
-    return resultHolder.result;
+    auto value = Detail::decodeField<Detail::ResultHolder<R>>(ret, "value", true);
+    if (!value)
+      throw std::runtime_error("Response has no value");
+    return value->result;
   }
 
   static expns::expected <R, std::string> outcomeToExpected(Aws::Lambda::Model::InvokeOutcome &outcome) {
-    if(outcome.IsSuccess()) 
+    if(!outcome.IsSuccess())
+      return expns::unexpected(outcome.GetError().GetMessage());
+    // Callbacks must be called even when the function failed or its result cannot be decoded
+    try {
       return handleSuccessfulInvocation(outcome.GetResult());
-    else
+    } catch (std::exception const &e) {
+      return expns::unexpected(std::string(e.what()));
+    }
+  }
+
+  // A function error fails each of the size calls like a single invocation, e.g. with unexpected results
+  // for expected return types
+  static BatchResult<R> handleSuccessfulBatch(Aws::Lambda::Model::InvokeResult &result, std::size_t size) {
+    Aws::String ret = Detail::readPayload(result);
+    if (result.GetFunctionError().length()) {
+      BatchResult<R> batch;
+      batch.results.assign(size, HandleFunctionError<R>{}(ret));
+      return batch;
+    }
+    auto values = Detail::decodeField<Detail::ResultHolder<std::vector<R>>>(ret, "values", true);
+    if (!values)
+      throw std::runtime_error("Response has no values");
+    BatchResult<R> batch;
+    batch.results = std::move(values->result);
+    batch.computeTime = std::chrono::microseconds(Detail::int64Field(ret, "compute_us").value_or(0));
+    batch.contextInitTime = std::chrono::microseconds(Detail::int64Field(ret, "context_init_us").value_or(0));
+    batch.contextTime = std::chrono::microseconds(Detail::int64Field(ret, "context_us").value_or(0));
+    return batch;
+  }
+
+  static expns::expected <BatchResult<R>, std::string> batchOutcomeToExpected(Aws::Lambda::Model::InvokeOutcome &outcome,
+                                                                              std::size_t size) {
+    if(!outcome.IsSuccess())
       return expns::unexpected(outcome.GetError().GetMessage());
+    try {
+      return handleSuccessfulBatch(outcome.GetResult(), size);
+    } catch (std::exception const &e) {
+      return expns::unexpected(std::string(e.what()));
+    }
   }
 
-  R operator()(Args... args) {
-    Aws::Lambda::Model::InvokeRequest invokeRequest;
-    invokeRequest.SetFunctionName(name);
-    invokeRequest.SetInvocationType(Aws::Lambda::Model::InvocationType::RequestResponse);
-    invokeRequest.SetLogType(Aws::Lambda::Model::LogType::Tail);
+  Aws::String encodeArgs(Args... args) const {
     // Add dummy args to work around https://github.com/p-ranav/alpaca/issues/22#issuecomment-1569568081 
-    Detail::ArgsHolder argsHolder(std::tuple(0, 0, args...));
-    std::vector<uint8_t> bytes;
-    auto bytes_written = alpaca::serialize(argsHolder, bytes);
-    static_assert(sizeof(uint8_t) == sizeof(unsigned char), "Platform breaks our assumption that characters are 8 bits");
-    Aws::Utils::ByteBuffer byteBuffer(reinterpret_cast<unsigned char *>(&bytes.front()), bytes_written);
-    Aws::Utils::Json::JsonValue jsonPayload;
-    jsonPayload.WithString("serialized",  Aws::Utils::HashingUtils::Base64Encode(byteBuffer));
-    std::shared_ptr <Aws::IOStream> payload
-        = Aws::MakeShared<Aws::StringStream>("lambda argument", jsonPayload.View().WriteReadable());
-    invokeRequest.SetBody(payload);
-    invokeRequest.SetContentType("application/json");
-    auto outcome = client.client->Invoke(invokeRequest);
+    return Detail::encode(Detail::ArgsHolder(std::tuple(0, 0, args...)), client.flatEncoding);
+  }
+
+  Aws::String encodeBatch(std::vector<ArgsTuple> const &batch) const {
+    return Detail::encode(Detail::ArgsHolder(std::tuple(0, 0, batch)), client.flatEncoding);
+  }
+
+  // Offloaded arguments are stored in argument, to be deleted with Detail::deleteArgument after the response
+  Aws::Lambda::Model::InvokeRequest request(char const *key, Aws::String const &encoded,
+                                            std::optional<s3location> &argument) const {
+    auto invokeRequest = Detail::makeInvokeRequest(name, key, encoded, client.offload ? &*client.offload : nullptr,
+                                                   fields(), &argument);
+    if (client.telemetry)
+      invokeRequest.SetLogType(Aws::Lambda::Model::LogType::Tail);
+    return invokeRequest;
+  }
+
+  Detail::Observer observer() const {
+    if (!client.telemetry)
+      return {};
+    return {client.telemetry, function ? name + "#" + std::to_string(*function) : name};
+  }
+
+  // Payload fields naming the function in a multiplexed deployment, and asking for flat results
+  std::string fields() const {
+    std::string fields = function ? ",\"function\":" + std::to_string(*function) : std::string();
+    if (client.flatEncoding)
+      fields += ",\"" + std::string(Detail::flatField) + "\":1";
+    return fields;
+  }
+
+  R operator()(Args... args) {
+    std::optional<s3location> argument;
+    auto outcome = client.invoke(request("serialized", encodeArgs(args...), argument));
+    Detail::deleteArgument(argument);
+    observer()(outcome);
     if (outcome.IsSuccess())
       return handleSuccessfulInvocation(outcome.GetResult());
     Aws::Lambda::LambdaError e = outcome.GetError();
-    throw std::runtime_error(e.GetMessage());
+    throw std::runtime_error(e.GetMessage().c_str());
   }
 
+  // Invokes with the encoded payload under key, and calls c with the decoded result
   template<typename Callable>
-  void invoke_async(Callable c, Args... args) {
-    Aws::Lambda::Model::InvokeRequest invokeRequest;
-    invokeRequest.SetFunctionName(name);
-    invokeRequest.SetInvocationType(Aws::Lambda::Model::InvocationType::RequestResponse);
-    invokeRequest.SetLogType(Aws::Lambda::Model::LogType::Tail);
-    // Add dummy args to work around https://github.com/p-ranav/alpaca/issues/22#issuecomment-1569568081 
-    Detail::ArgsHolder argsHolder(std::tuple(0, 0, args...));
-    std::vector<uint8_t> bytes;
-    auto bytes_written = alpaca::serialize(argsHolder, bytes);
-    static_assert(sizeof(uint8_t) == sizeof(unsigned char), "Platform breaks our assumption that characters are 8 bits");
-    Aws::Utils::ByteBuffer byteBuffer(reinterpret_cast<unsigned char *>(&bytes.front()), bytes_written);
-    Aws::Utils::Json::JsonValue jsonPayload;
-    jsonPayload.WithString("serialized",  Aws::Utils::HashingUtils::Base64Encode(byteBuffer));
-    std::shared_ptr <Aws::IOStream> payload
-        = Aws::MakeShared<Aws::StringStream>("lambda argument", jsonPayload.View().WriteReadable());
-    invokeRequest.SetBody(payload);
-    invokeRequest.SetContentType("application/json");
-    client.client->InvokeAsync(
-      invokeRequest, 
-      [c](const Aws::Lambda::LambdaClient*, const Aws::Lambda::Model::InvokeRequest&, 
-          Aws::Lambda::Model::InvokeOutcome outcome, 
-          const std::shared_ptr<const Aws::Client::AsyncCallerContext>&) {
+  void invokeKeyedAsync(Callable c, char const *key, Aws::String const &encoded) {
+    std::optional<s3location> argument;
+    auto invokeRequest = request(key, encoded, argument);
+    client.invokeAsync(
+      invokeRequest,
+      [c, observe = observer(), argument](Aws::Lambda::Model::InvokeOutcome outcome) {
+        Detail::deleteArgument(argument);
+        observe(outcome);
         c(outcomeToExpected(outcome));
       });
   }
 
+  template<typename Callable>
+  void invoke_async(Callable c, Args... args) {
+    invokeKeyedAsync(c, "serialized", encodeArgs(args...));
+  }
+
+  // For co_await l.co_invoke(args...) in a coroutine, resumed on the executor thread completing the
+  // invocation. Throws std::runtime_error when the invocation failed.
+  auto co_invoke(Args... args) {
+    struct awaiter {
+      Lambda l;
+      Aws::String encoded;
+      std::optional<expns::expected<R, std::string>> result;
+
+      bool await_ready() const noexcept { return false; }
+
+      // The callback may resume the coroutine, destroying this awaiter, before InvokeAsync returns
+      void await_suspend(std::coroutine_handle<> h) {
+        l.invokeKeyedAsync([this, h](expns::expected<R, std::string> e) {
+          result = std::move(e);
+          h.resume();
+        }, "serialized", encoded);
+      }
+
+      R await_resume() {
+        if (*result)
+          return std::move(**result);
+        throw std::runtime_error(result->error());
+      }
+    };
+    return awaiter{*this, encodeArgs(args...), std::nullopt};
+  }
+
+  // Before a large fan out, starts n containers, or keeps n warm, with concurrent invocations that the
+  // handler holds for hold without running the function, so each lands on its own container. They also open
+  // the client's connections to the endpoint. Invocations past client.concurrency() would only start once
+  // earlier ones finished, on containers already warm, so n is capped at it. Returns the number of invocations
+  // that succeeded, which is below n when the cap applied.
+  std::size_t prewarm(std::size_t n, std::chrono::milliseconds hold = std::chrono::milliseconds(100)) {
+    n = std::min(n, client.concurrency());
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::size_t done = 0, succeeded = 0;
+    for (std::size_t i = 0; i < n; ++i)
+      client.invokeAsync(
+        Detail::makePrewarmRequest(name, hold, fields()),
+        [&](Aws::Lambda::Model::InvokeOutcome outcome) {
+          std::lock_guard lock(mutex);
+          ++done;
+          if (outcome.IsSuccess() && outcome.GetResult().GetFunctionError().empty())
+            ++succeeded;
+          cv.notify_all();
+        });
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [&] { return done == n; });
+    return succeeded;
+  }
+
+  // Folds values with the reduction operation of the handler
+  template<typename Callable>
+  void invoke_reduce_async(Callable c, std::vector<R> const &values) {
+    invokeKeyedAsync(c, "reduce", Detail::encode(Detail::ArgsHolder(std::tuple(0, 0, values)), client.flatEncoding));
+  }
+
+  // Folds the results of the function on every argument tuple with the reduction operation of the handler
+  template<typename Callable>
+  void invoke_transform_reduce_async(Callable c, std::vector<ArgsTuple> const &batch) {
+    invokeKeyedAsync(c, "transform_reduce", encodeBatch(batch));
+  }
+
+  // Runs the function on every argument tuple in a single invocation. The handler spreads
+  // the tuples over the vCPUs of its container.
+  BatchResult<R> invoke_batch(std::vector<ArgsTuple> const &batch) {
+    std::optional<s3location> argument;
+    auto outcome = client.invoke(request("batch", encodeBatch(batch), argument));
+    Detail::deleteArgument(argument);
+    observer()(outcome);
+    if (outcome.IsSuccess())
+      return handleSuccessfulBatch(outcome.GetResult(), batch.size());
+    Aws::Lambda::LambdaError e = outcome.GetError();
+    throw std::runtime_error(e.GetMessage().c_str());
+  }
+
+  template<typename Callable>
+  void invoke_batch_async(Callable c, std::vector<ArgsTuple> const &batch) {
+    std::optional<s3location> argument;
+    auto invokeRequest = request("batch", encodeBatch(batch), argument);
+    client.invokeAsync(
+      invokeRequest,
+      [c, observe = observer(), size = batch.size(), argument](Aws::Lambda::Model::InvokeOutcome outcome) {
+        Detail::deleteArgument(argument);
+        observe(outcome);
+        c(batchOutcomeToExpected(outcome, size));
+      });
+  }
+
   EnhancedLambdaClient &client;
   std::string name;
+  // Set for functions of a MultiplexedHandler deployment
+  std::optional<uint32_t> function;
 };
 
 
@@ -186,16 +636,571 @@ async(cloud_launch, Lambda<R(Args...)> l, Args ...args) {
     return f;
 }
 
+// Launch policy keeping at most max_in_flight invocations outstanding
+struct cloud_window {
+  // 0 uses the concurrency() of the client
+  std::size_t max_in_flight = 0;
+};
+
+namespace Detail {
+// Results of the invocations in flight, slot i % window holds the result for input i
+template<typename R>
+struct TransformWindow {
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::vector<std::optional<expns::expected<R, std::string>>> slots;
+  explicit TransformWindow(std::size_t window) : slots(window) {}
+
+  void put(std::size_t input, expns::expected<R, std::string> result) {
+    std::lock_guard lock(mutex);
+    slots[input % slots.size()] = std::move(result);
+    ready.notify_all();
+  }
+
+  // Waits for the result for input and frees its slot
+  expns::expected<R, std::string> take(std::size_t input) {
+    std::unique_lock lock(mutex);
+    auto &slot = slots[input % slots.size()];
+    ready.wait(lock, [&] { return slot.has_value(); });
+    auto result = std::move(*slot);
+    slot.reset();
+    return result;
+  }
+};
+}
+
+// Invokes l on every input, keeping at most policy.max_in_flight invocations outstanding. New inputs are
+// read as results complete, and results are written to out in input order as soon as all previous ones are.
+// Throws std::runtime_error for the first failed invocation in input order.
+template<typename InpIt, typename OutIt, typename R, typename ...Args>
+auto
+transform(cloud_window policy, InpIt beg, InpIt end, OutIt out, Lambda<R(Args...)> l)
+{
+  auto window = policy.max_in_flight ? policy.max_in_flight : l.client.concurrency();
+  // Shared with the callbacks, which may still run after a failure is thrown
+  auto state = std::make_shared<Detail::TransformWindow<R>>(window);
+  std::size_t issued = 0, written = 0;
+  while (true) {
+    for (; beg != end && issued - written < window; ++beg, ++issued) {
+      auto callback = [state, input = issued](expns::expected<R, std::string> e) { state->put(input, std::move(e)); };
+      // Functions of several arguments take tuples of them as inputs
+      if constexpr (sizeof...(Args) == 1)
+        l.invoke_async(callback, *beg);
+      else
+        std::apply([&](auto const &...args) { l.invoke_async(callback, args...); },
+                   typename Lambda<R(Args...)>::ArgsTuple(*beg));
+    }
+    if (written == issued)
+      return out;
+    auto result = state->take(written);
+    if (!result)
+      throw std::runtime_error(result.error());
+    *out++ = std::move(*result);
+    ++written;
+  }
+}
+
 template<typename InpIt, typename OutIt, typename R, typename ...Args>
 auto
 transform(cloud_launch, InpIt beg, InpIt end, OutIt out, Lambda<R(Args...)> l)
 {
-  std::vector<std::future<R>> futures;
-  std::transform(beg, end, std::back_inserter(futures), [&](auto x) { 
-    return async(cloud_launch::cloud, l, x); 
-    });
-  return std::transform(futures.begin(), futures.end(), out, [](auto &x) { return x.get(); });
+  return transform(cloud_window{}, beg, end, out, l);
+}
+
+// Launch policy packing many argument tuples in each invocation
+struct cloud_batch {
+  // Duration each invocation should compute for. Longer batches amortize the invocation overhead,
+  // shorter ones spread the work over more containers.
+  std::chrono::milliseconds target_duration = std::chrono::milliseconds(1000);
+  // Size of the first batch, whose compute time sizes the following ones
+  std::size_t initial_batch = 8;
+  // Upper bound on the batch size, keeping payloads below the Lambda limit
+  std::size_t max_batch = 4096;
+  // Batches outstanding at most, 0 uses the concurrency() of the client
+  std::size_t max_in_flight = 0;
+};
+
+template<typename R, typename ...Args>
+auto
+async(cloud_launch, Lambda<R(Args...)> l, std::vector<typename Lambda<R(Args...)>::ArgsTuple> const &batch) {
+    auto p=std::make_shared<std::promise<BatchResult<R>>>();
+    auto f = p->get_future();
+    l.invoke_batch_async([p](expns::expected<BatchResult<R>, std::string> e) {
+      try {
+        if (e)
+          p->set_value(std::move(*e));
+        else
+          p->set_exception(std::make_exception_ptr(std::runtime_error(e.error())));
+      } catch(...) {}
+      }, batch);
+    return f;
+}
+
+namespace Detail {
+// Number of items per batch so an invocation computes for about the target duration, given that
+// probeSize items took probeTime
+inline std::size_t batchSizeFor(cloud_batch const &policy, std::size_t probeSize, std::chrono::microseconds probeTime) {
+  if (probeTime.count() <= 0)
+    return std::max<std::size_t>(1, policy.max_batch);
+  auto target = std::chrono::duration_cast<std::chrono::microseconds>(policy.target_duration).count();
+  auto size = static_cast<std::size_t>(static_cast<double>(target) * probeSize / probeTime.count());
+  return std::clamp<std::size_t>(size, 1, std::max<std::size_t>(1, policy.max_batch));
 }
 }
 
-#endif
\ No newline at end of file
+// Like transform(cloud_window, ...) but with several elements per invocation. A first batch of
+// policy.initial_batch elements measures the compute time per element, and the remaining elements are
+// sent in batches sized to compute for policy.target_duration, with at most policy.max_in_flight of them
+// outstanding. Batches are read and encoded as earlier ones complete.
+template<typename InpIt, typename OutIt, typename R, typename ...Args>
+auto
+transform(cloud_batch policy, InpIt beg, InpIt end, OutIt out, Lambda<R(Args...)> l)
+{
+  using ArgsTuple = typename Lambda<R(Args...)>::ArgsTuple;
+  auto next = [&](std::size_t size) {
+    std::vector<ArgsTuple> batch;
+    for (; beg != end && batch.size() < size; ++beg)
+      batch.push_back(ArgsTuple(*beg));
+    return batch;
+  };
+  auto probeBatch = next(std::max<std::size_t>(1, policy.initial_batch));
+  if (probeBatch.empty())
+    return out;
+  auto probe = l.invoke_batch(probeBatch);
+  out = std::move(probe.results.begin(), probe.results.end(), out);
+  auto batchSize = Detail::batchSizeFor(policy, probeBatch.size(), probe.computeTime);
+  auto window = policy.max_in_flight ? policy.max_in_flight : l.client.concurrency();
+  // Shared with the callbacks, which may still run after a failure is thrown
+  auto state = std::make_shared<Detail::TransformWindow<BatchResult<R>>>(window);
+  std::size_t issued = 0, written = 0;
+  while (true) {
+    for (; beg != end && issued - written < window; ++issued)
+      l.invoke_batch_async([state, input = issued](expns::expected<BatchResult<R>, std::string> e) {
+        state->put(input, std::move(e));
+      }, next(batchSize));
+    if (written == issued)
+      return out;
+    auto batch = state->take(written);
+    if (!batch)
+      throw std::runtime_error(batch.error());
+    out = std::move(batch->results.begin(), batch->results.end(), out);
+    ++written;
+  }
+}
+
+// Launch policy of the cloud reduce and transform_reduce
+struct cloud_reduce {
+  // Inputs folded per invocation, 0 spreads the inputs over concurrency() invocations
+  std::size_t chunk_size = 0;
+  // Partial results folded per invocation when combining them
+  std::size_t fan_in = 32;
+};
+
+namespace Detail {
+template<typename R, typename Invoke>
+std::future<R> futureOf(Invoke invoke) {
+  auto p = std::make_shared<std::promise<R>>();
+  auto f = p->get_future();
+  invoke([p](expns::expected<R, std::string> e) {
+    try {
+      if (e)
+        p->set_value(std::move(*e));
+      else
+        p->set_exception(std::make_exception_ptr(std::runtime_error(e.error())));
+    } catch(...) {}
+  });
+  return f;
+}
+
+inline std::size_t chunkSize(cloud_reduce const &policy, std::size_t inputs, EnhancedLambdaClient &client) {
+  if (policy.chunk_size)
+    return policy.chunk_size;
+  auto invocations = std::max<std::size_t>(1, client.concurrency());
+  return std::max<std::size_t>(1, (inputs + invocations - 1) / invocations);
+}
+
+// Folds values in a tree of invocations, width values per invocation at the first level and
+// fanIn at the next ones, until a single value remains
+template<typename R, typename ...Args>
+R reduceInCloud(Lambda<R(Args...)> l, std::vector<R> values, std::size_t width, std::size_t fanIn) {
+  while (values.size() > 1) {
+    width = std::max<std::size_t>(2, width);
+    std::vector<std::future<R>> partials;
+    for (std::size_t first = 0; first < values.size(); first += width) {
+      std::vector<R> chunk(values.begin() + first, values.begin() + std::min(values.size(), first + width));
+      if (chunk.size() == 1) {
+        std::promise<R> single;
+        single.set_value(std::move(chunk.front()));
+        partials.push_back(single.get_future());
+      } else {
+        partials.push_back(futureOf<R>([&](auto c) { l.invoke_reduce_async(c, chunk); }));
+      }
+    }
+    values.clear();
+    for (auto &partial : partials)
+      values.push_back(partial.get());
+    width = fanIn;
+  }
+  return std::move(values.front());
+}
+}
+
+// Folds init and the inputs with op, a Lambda running a binary operation deployed as Handler(&op).
+// Chunks of inputs are folded in concurrent invocations and their results combined in a tree of
+// invocations, so only one value per invocation comes back to the client.
+template<typename InpIt, typename T>
+T
+reduce(cloud_reduce policy, InpIt beg, InpIt end, T init, Lambda<T(T, T)> op)
+{
+  std::vector<T> values{init};
+  std::copy(beg, end, std::back_inserter(values));
+  auto width = Detail::chunkSize(policy, values.size(), op.client);
+  return Detail::reduceInCloud(op, std::move(values), width, policy.fan_in);
+}
+
+template<typename InpIt, typename T>
+T
+reduce(cloud_launch, InpIt beg, InpIt end, T init, Lambda<T(T, T)> op)
+{
+  return reduce(cloud_reduce{}, beg, end, init, op);
+}
+
+// Folds init and the results of l on the inputs. l runs a function deployed with its reduction
+// operation, e.g. Handler(&f, &op), and folds the results of each chunk of inputs in the invocation
+// that computed them. The partial results are combined in a tree of invocations.
+template<typename InpIt, typename T, typename ...Args>
+T
+transform_reduce(cloud_reduce policy, InpIt beg, InpIt end, T init, Lambda<T(Args...)> l)
+{
+  using ArgsTuple = typename Lambda<T(Args...)>::ArgsTuple;
+  std::vector<ArgsTuple> items;
+  std::transform(beg, end, std::back_inserter(items), [](auto const &x) { return ArgsTuple(x); });
+  auto chunk = Detail::chunkSize(policy, items.size(), l.client);
+  std::vector<std::future<T>> partials;
+  for (std::size_t first = 0; first < items.size(); first += chunk) {
+    std::vector<ArgsTuple> batch(items.begin() + first, items.begin() + std::min(items.size(), first + chunk));
+    partials.push_back(Detail::futureOf<T>([&](auto c) { l.invoke_transform_reduce_async(c, batch); }));
+  }
+  std::vector<T> values{init};
+  for (auto &partial : partials)
+    values.push_back(partial.get());
+  return Detail::reduceInCloud(l, std::move(values), policy.fan_in, policy.fan_in);
+}
+
+template<typename InpIt, typename T, typename ...Args>
+T
+transform_reduce(cloud_launch, InpIt beg, InpIt end, T init, Lambda<T(Args...)> l)
+{
+  return transform_reduce(cloud_reduce{}, beg, end, init, l);
+}
+
+// Launch policy running the function both on local threads and in the cloud, each side taking the
+// next input whenever it finishes one
+struct cloud_hybrid {
+  // Local threads, including the calling one
+  std::size_t local_threads = std::max(1u, std::thread::hardware_concurrency());
+  // Invocations kept in flight, 0 uses the concurrency() of the client
+  std::size_t max_in_flight = 0;
+};
+
+namespace Detail {
+// Inputs shared by the local threads and the cloud invocations of a hybrid transform
+template<typename R, typename ArgsTuple>
+struct HybridWork {
+  std::vector<ArgsTuple> items;
+  std::vector<std::optional<R>> results;
+  std::vector<char> stolen;         // computed locally while its invocation was in flight
+  std::deque<std::size_t> inFlight; // in the cloud, oldest first
+  std::deque<std::size_t> retry;    // whose invocation failed, left to the local threads
+  std::size_t next = 0;
+  std::size_t completed = 0;
+  bool local = true;
+  std::string error;
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  bool finished() const {
+    return completed == items.size() || !error.empty();
+  }
+
+  void complete(std::size_t i, R result) {
+    std::lock_guard lock(mutex);
+    if (!results[i]) {
+      results[i] = std::move(result);
+      ++completed;
+      changed.notify_all();
+    }
+  }
+
+  void fail(std::string message) {
+    std::lock_guard lock(mutex);
+    if (error.empty())
+      error = message.empty() ? "Invocation failed" : std::move(message);
+    changed.notify_all();
+  }
+
+  // Next input for a local thread: a failed invocation, an input nobody took yet, or the oldest
+  // input still in the cloud. Returns false once all inputs are done.
+  bool claimLocal(std::size_t &i) {
+    std::unique_lock lock(mutex);
+    while (!finished()) {
+      if (!retry.empty()) {
+        i = retry.front();
+        retry.pop_front();
+        return true;
+      }
+      if (next < items.size()) {
+        i = next++;
+        return true;
+      }
+      for (auto candidate : inFlight) {
+        if (!stolen[candidate] && !results[candidate]) {
+          stolen[candidate] = true;
+          i = candidate;
+          return true;
+        }
+      }
+      changed.wait(lock);
+    }
+    return false;
+  }
+
+  bool claimCloud(std::size_t &i) {
+    std::lock_guard lock(mutex);
+    if (finished() || next == items.size())
+      return false;
+    i = next++;
+    inFlight.push_back(i);
+    return true;
+  }
+
+  void cloudDone(std::size_t i, expns::expected<R, std::string> e) {
+    {
+      std::lock_guard lock(mutex);
+      inFlight.erase(std::find(inFlight.begin(), inFlight.end(), i));
+    }
+    if (e)
+      return complete(i, std::move(*e));
+    std::lock_guard lock(mutex);
+    if (!local && error.empty())
+      error = e.error();
+    else if (!stolen[i] && !results[i])
+      retry.push_back(i);
+    changed.notify_all();
+  }
+};
+
+// Starts an invocation on the next input, and another one each time an invocation completes
+template<typename R, typename ...Args>
+void launchHybrid(std::shared_ptr<HybridWork<R, typename Lambda<R(Args...)>::ArgsTuple>> work, Lambda<R(Args...)> l) {
+  std::size_t i;
+  if (!work->claimCloud(i))
+    return;
+  std::apply([&](auto const &...args) {
+    l.invoke_async([work, l, i](expns::expected<R, std::string> e) {
+      work->cloudDone(i, std::move(e));
+      launchHybrid(work, l);
+    }, args...);
+  }, work->items[i]);
+}
+}
+
+// Transforms the inputs with local, running on policy.local_threads threads, and with l, keeping
+// policy.max_in_flight invocations outstanding, both pulling inputs from a shared queue so the faster
+// side computes more of them. Once every input is taken, idle local threads also compute the inputs
+// still in the cloud, and inputs whose invocation failed are computed locally.
+// local must compute the same function as the one deployed for l.
+template<typename InpIt, typename OutIt, typename R, typename ...Args, typename Local>
+auto
+transform(cloud_hybrid policy, InpIt beg, InpIt end, OutIt out, Lambda<R(Args...)> l, Local local)
+{
+  using ArgsTuple = typename Lambda<R(Args...)>::ArgsTuple;
+  auto work = std::make_shared<Detail::HybridWork<R, ArgsTuple>>();
+  std::transform(beg, end, std::back_inserter(work->items), [](auto const &x) { return ArgsTuple(x); });
+  work->results.resize(work->items.size());
+  work->stolen.resize(work->items.size());
+  work->local = policy.local_threads > 0;
+  auto window = policy.max_in_flight ? policy.max_in_flight : l.client.concurrency();
+  for (std::size_t w = 0; w < std::min(window, work->items.size()); ++w)
+    Detail::launchHybrid(work, l);
+
+  auto computeLocally = [&] {
+    std::size_t i;
+    while (work->claimLocal(i)) {
+      try {
+        work->complete(i, std::apply(local, work->items[i]));
+      } catch (std::exception const &e) {
+        work->fail(e.what());
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (std::size_t t = 1; t < policy.local_threads; ++t)
+    threads.emplace_back(computeLocally);
+  if (policy.local_threads)
+    computeLocally();
+  for (auto &thread : threads)
+    thread.join();
+  std::unique_lock lock(work->mutex);
+  work->changed.wait(lock, [&] { return work->finished(); });
+  if (!work->error.empty())
+    throw std::runtime_error(work->error);
+  // Invocations still in flight only hold the shared work
+  for (auto &result : work->results)
+    *out++ = std::move(*result);
+  return out;
+}
+
+// A function whose invocations may run more than once with the same arguments, which speculative
+// execution requires. Usable wherever its Lambda is.
+template<typename Sig>
+struct Idempotent;
+
+template<typename R, typename ...Args>
+struct Idempotent<R(Args...)> : Lambda<R(Args...)> {
+  explicit Idempotent(Lambda<R(Args...)> l) : Lambda<R(Args...)>(l) {}
+};
+
+template<typename R, typename ...Args>
+Idempotent<R(Args...)> idempotent(Lambda<R(Args...)> l) {
+  return Idempotent<R(Args...)>(l);
+}
+
+// What speculative execution did
+struct SpeculationReport {
+  std::size_t speculations = 0; // invocations issued again
+  std::size_t wins = 0;         // speculative invocations finishing first
+};
+
+// Launch policy re-issuing invocations running much longer than the completed ones, once most
+// results are in. The first result for an input wins.
+struct cloud_speculate {
+  // 0 uses the concurrency() of the client, speculative invocations are not counted
+  std::size_t max_in_flight = 0;
+  // Fraction of the results in before speculating, and quantile of their latencies stragglers are compared to
+  double quantile = 0.9;
+  // Invocations running longer than slowdown times the latency quantile are issued again, once each
+  double slowdown = 2.0;
+  // Receives what happened when not null
+  SpeculationReport *report = nullptr;
+};
+
+namespace Detail {
+template<typename R, typename ArgsTuple>
+struct SpeculativeWork {
+  using Clock = std::chrono::steady_clock;
+  std::vector<ArgsTuple> items;
+  std::vector<std::optional<R>> results;
+  std::vector<Clock::time_point> started; // of the first invocation
+  std::vector<unsigned char> pending;     // invocations outstanding
+  std::vector<char> speculated;
+  std::vector<Clock::duration> latencies; // of the completed inputs
+  std::size_t inFlight = 0;               // inputs invoked and not completed
+  SpeculationReport report;
+  std::string error;
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  void done(std::size_t i, bool speculative, expns::expected<R, std::string> e) {
+    std::lock_guard lock(mutex);
+    --pending[i];
+    if (results[i])
+      return;
+    if (e) {
+      results[i] = std::move(*e);
+      latencies.push_back(Clock::now() - started[i]);
+      --inFlight;
+      report.wins += speculative;
+    } else if (!pending[i] && error.empty()) {
+      error = e.error();
+    }
+    changed.notify_all();
+  }
+};
+
+template<typename R, typename ...Args>
+void invokeSpeculative(std::shared_ptr<SpeculativeWork<R, typename Lambda<R(Args...)>::ArgsTuple>> work,
+                       Lambda<R(Args...)> l, std::size_t i, bool speculative) {
+  std::apply([&](auto const &...args) {
+    l.invoke_async([work, i, speculative](expns::expected<R, std::string> e) {
+      work->done(i, speculative, std::move(e));
+    }, args...);
+  }, work->items[i]);
+}
+}
+
+// Invokes l on every input, keeping policy.max_in_flight invocations outstanding, and once policy.quantile
+// of the results are in, invokes again the inputs running longer than policy.slowdown times the
+// policy.quantile latency. Results are written in input order. Throws std::runtime_error when every
+// invocation of an input failed.
+template<typename InpIt, typename OutIt, typename R, typename ...Args>
+auto
+transform(cloud_speculate policy, InpIt beg, InpIt end, OutIt out, Idempotent<R(Args...)> l)
+{
+  using ArgsTuple = typename Lambda<R(Args...)>::ArgsTuple;
+  using Clock = std::chrono::steady_clock;
+  Lambda<R(Args...)> lambda = l;
+  auto work = std::make_shared<Detail::SpeculativeWork<R, ArgsTuple>>();
+  std::transform(beg, end, std::back_inserter(work->items), [](auto const &x) { return ArgsTuple(x); });
+  auto n = work->items.size();
+  work->results.resize(n);
+  work->started.resize(n);
+  work->pending.resize(n);
+  work->speculated.resize(n);
+  auto window = policy.max_in_flight ? policy.max_in_flight : l.client.concurrency();
+  auto threshold = static_cast<std::size_t>(policy.quantile * n);
+  std::size_t next = 0;
+  std::unique_lock lock(work->mutex);
+  while (work->latencies.size() < n && work->error.empty()) {
+    // Invoked without the lock, in case a callback runs on this thread
+    std::vector<std::pair<std::size_t, bool>> launches;
+    for (; next < n && work->inFlight < window; ++next) {
+      work->started[next] = Clock::now();
+      ++work->inFlight;
+      launches.emplace_back(next, false);
+    }
+    auto speculating = next == n && work->latencies.size() >= std::max<std::size_t>(threshold, 1);
+    auto nextCheck = Clock::time_point::max();
+    if (speculating) {
+      auto sorted = work->latencies;
+      auto q = sorted.begin() + std::min(sorted.size() - 1, static_cast<std::size_t>(policy.quantile * sorted.size()));
+      std::nth_element(sorted.begin(), q, sorted.end());
+      auto limit = std::chrono::duration_cast<Clock::duration>(*q * policy.slowdown);
+      auto now = Clock::now();
+      for (std::size_t i = 0; i < n; ++i) {
+        if (work->results[i] || work->speculated[i])
+          continue;
+        if (now - work->started[i] > limit) {
+          work->speculated[i] = true;
+          ++work->report.speculations;
+          launches.emplace_back(i, true);
+        } else {
+          nextCheck = std::min(nextCheck, work->started[i] + limit);
+        }
+      }
+    }
+    if (!launches.empty()) {
+      for (auto [i, speculative] : launches)
+        ++work->pending[i];
+      lock.unlock();
+      for (auto [i, speculative] : launches)
+        Detail::invokeSpeculative(work, lambda, i, speculative);
+      lock.lock();
+    } else if (speculating && nextCheck != Clock::time_point::max()) {
+      work->changed.wait_until(lock, nextCheck);
+    } else {
+      work->changed.wait(lock);
+    }
+  }
+  if (policy.report)
+    *policy.report = work->report;
+  if (!work->error.empty())
+    throw std::runtime_error(work->error);
+  // Invocations still in flight only hold the shared work
+  for (auto &result : work->results)
+    *out++ = std::move(*result);
+  return out;
+}
+}
+
+#endif
@@ -0,0 +1,267 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/core/utils/UUID.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "lambda_client.h"
+#include "s3list.h"
+
+namespace AwsLabs::Enhanced {
+
+struct EventOptions {
+  // Interval between listings of the results
+  std::chrono::milliseconds poll{1000};
+  // Items without a result this long after they were invoked fail, never when 0. Lambda may keep
+  // throttled Event invocations queued for hours.
+  std::chrono::seconds timeout{0};
+};
+
+namespace Detail {
+// Event payloads are capped at 256KB, so larger arguments always go through the bucket
+inline constexpr std::size_t eventThreshold = 180 * 1024;
+}
+
+template<typename Sig>
+class EventJob;
+
+/**
+ * Runs Lambda invocations of type Event, which return as soon as Lambda queued them, so no connection is
+ * held while the function runs. The handler writes each response under prefix + job ID + "/" + item index in
+ * the bucket of target, and a background thread lists that prefix every poll interval, reading and deleting
+ * what it finds. Results of invoke come through the returned futures and results of submit through next.
+ * Arguments offloaded to the bucket are kept until the result of their item arrived, as Lambda retries failed
+ * Event invocations, and deleted when the item completes or fails. Results still in the bucket when the job
+ * is destroyed are left to the expiration rule of the prefix.
+ */
+template<typename R, typename ...Args>
+class EventJob<R(Args...)> {
+public:
+  using Result = expns::expected<R, std::string>;
+
+  EventJob(Lambda<R(Args...)> lambda, LambdaOffload target, EventOptions options = {})
+      : lambda(lambda), target(std::move(target)), options(options),
+        prefix(this->target.prefix + std::string(Aws::Utils::UUID::RandomUUID().c_str()) + "/") {
+    this->target.threshold = std::min(this->target.threshold, Detail::eventThreshold);
+    poller = std::thread([this] { poll(); });
+  }
+
+  // Waits for the invocations being queued by Lambda, not for their results. Items still outstanding fail.
+  ~EventJob() {
+    {
+      std::unique_lock lock(mutex);
+      cv.wait(lock, [this] { return queueing == 0; });
+      stopping = true;
+    }
+    cv.notify_all();
+    poller.join();
+    std::vector<std::size_t> outstanding;
+    {
+      std::lock_guard lock(mutex);
+      for (auto const &[index, item] : items)
+        outstanding.push_back(index);
+    }
+    for (auto index : outstanding)
+      complete(index, expns::unexpected(std::string("EventJob destroyed before the result arrived")));
+  }
+
+  EventJob(EventJob const &) = delete;
+  EventJob &operator=(EventJob const &) = delete;
+
+  // Invokes with args and returns the index of the item, whose result next returns
+  std::size_t submit(Args... args) {
+    return start(std::nullopt, args...);
+  }
+
+  std::future<R> invoke(Args... args) {
+    std::promise<R> promise;
+    auto result = promise.get_future();
+    start(std::move(promise), args...);
+    return result;
+  }
+
+  // The next result of a submitted item in completion order, waiting for it, or none once all were returned
+  std::optional<std::pair<std::size_t, Result>> next() {
+    std::unique_lock lock(mutex);
+    cv.wait(lock, [this] { return !completed.empty() || submitted == 0; });
+    if (completed.empty())
+      return std::nullopt;
+    auto result = std::move(completed.front());
+    completed.pop_front();
+    --submitted;
+    return result;
+  }
+
+  // Items invoked and not completed yet
+  std::size_t outstanding() {
+    std::lock_guard lock(mutex);
+    return items.size();
+  }
+
+private:
+  struct Item {
+    std::optional<std::promise<R>> promise;
+    std::chrono::steady_clock::time_point invoked;
+    // Object holding the offloaded arguments, for retries of the invocation
+    std::optional<s3location> argument;
+  };
+
+  std::size_t start(std::optional<std::promise<R>> promise, Args... args) {
+    std::size_t index;
+    {
+      std::lock_guard lock(mutex);
+      index = nextIndex++;
+      if (!promise)
+        ++submitted;
+      items.emplace(index, Item{std::move(promise), std::chrono::steady_clock::now()});
+      ++queueing;
+    }
+    s3location location(target.region.c_str(), target.bucket.c_str(), (prefix + std::to_string(index)).c_str());
+    std::optional<s3location> argument;
+    auto request = Detail::makeInvokeRequest(
+      lambda.name, "serialized", lambda.encodeArgs(args...), &target,
+      lambda.fields() + ",\"" + Detail::eventResultField + "\":\"" + Detail::formatLocation(location) + "\"",
+      &argument);
+    request.SetInvocationType(Aws::Lambda::Model::InvocationType::Event);
+    if (argument) {
+      // The item may already have expired while the arguments were uploaded
+      std::unique_lock lock(mutex);
+      if (auto found = items.find(index); found != items.end())
+        found->second.argument = std::exchange(argument, std::nullopt);
+      lock.unlock();
+      Detail::deleteArgument(argument);
+    }
+    lambda.client.invokeAsync(request, [this, index](Aws::Lambda::Model::InvokeOutcome outcome) {
+      if (!outcome.IsSuccess())
+        complete(index, expns::unexpected(std::string(outcome.GetError().GetMessage())));
+      // Notified under the lock, as the destructor may return as soon as it sees none queueing
+      std::lock_guard lock(mutex);
+      --queueing;
+      cv.notify_all();
+    });
+    return index;
+  }
+
+  void complete(std::size_t index, Result result) {
+    std::optional<std::promise<R>> promise;
+    std::optional<s3location> argument;
+    {
+      std::lock_guard lock(mutex);
+      auto found = items.find(index);
+      if (found == items.end())
+        return;
+      promise = std::move(found->second.promise);
+      argument = std::move(found->second.argument);
+      items.erase(found);
+      if (!promise)
+        completed.emplace_back(index, std::move(result));
+    }
+    cv.notify_all();
+    Detail::deleteArgument(argument);
+    if (!promise)
+      return;
+    if (result)
+      promise->set_value(std::move(*result));
+    else
+      promise->set_exception(std::make_exception_ptr(std::runtime_error(result.error())));
+  }
+
+  static Result decodeResult(std::vector<uint8_t> const &bytes) {
+    std::string payload(bytes.begin(), bytes.end());
+    try {
+      if (auto value = Detail::decodeField<Detail::ResultHolder<R>>(payload, "value"))
+        return std::move(value->result);
+      return expns::unexpected(std::string(JsonValue(Aws::String(payload.c_str())).View().GetString("errorMessage")));
+    } catch (std::exception const &e) {
+      return expns::unexpected(std::string(e.what()));
+    }
+  }
+
+  // Reads and deletes the results listed under the prefix, and fails the items past the timeout
+  void collect() {
+    std::vector<std::pair<std::size_t, s3location>> found;
+    s3prefix_range range(Detail::offloadClient(target.region), target.bucket, prefix);
+    for (auto object : range) {
+      std::size_t index;
+      auto name = object.key.substr(prefix.size());
+      auto [end, ec] = std::from_chars(name.data(), name.data() + name.size(), index);
+      if (ec == std::errc() && end == name.data() + name.size())
+        found.emplace_back(index, s3location(target.region.c_str(), target.bucket.c_str(), std::string(object.key).c_str()));
+    }
+    for (auto &[index, location] : found) {
+      std::vector<uint8_t> bytes;
+      Result result = expns::unexpected(std::string());
+      try {
+        Detail::takeOffloaded(location, bytes);
+        result = decodeResult(bytes);
+      } catch (std::exception const &e) {
+        result = expns::unexpected(std::string(e.what()));
+      }
+      complete(index, std::move(result));
+    }
+    if (options.timeout.count() == 0)
+      return;
+    std::vector<std::size_t> expired;
+    {
+      std::lock_guard lock(mutex);
+      auto deadline = std::chrono::steady_clock::now() - options.timeout;
+      for (auto const &[index, item] : items)
+        if (item.invoked < deadline)
+          expired.push_back(index);
+    }
+    for (auto index : expired)
+      complete(index, expns::unexpected(std::string("No result before the timeout")));
+  }
+
+  void poll() {
+    std::unique_lock lock(mutex);
+    while (!stopping) {
+      cv.wait_for(lock, options.poll, [this] { return stopping; });
+      if (stopping || items.empty())
+        continue;
+      lock.unlock();
+      try {
+        collect();
+      } catch (std::exception const &) {
+        // Listing failures are retried at the next poll
+      }
+      lock.lock();
+    }
+  }
+
+  Lambda<R(Args...)> lambda;
+  LambdaOffload target;
+  EventOptions options;
+  std::string prefix;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::map<std::size_t, Item> items;
+  std::deque<std::pair<std::size_t, Result>> completed;
+  std::size_t nextIndex = 0;
+  std::size_t submitted = 0; // submitted items not returned by next yet
+  std::size_t queueing = 0;  // invocations not yet accepted or refused by Lambda
+  bool stopping = false;
+  std::thread poller;
+};
+
+template<typename R, typename ...Args>
+EventJob(Lambda<R(Args...)>, LambdaOffload, EventOptions = {}) -> EventJob<R(Args...)>;
+}
@@ -0,0 +1,267 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/lambda/model/GetFunctionConfigurationRequest.h>
+#include <aws/core/utils/HashingUtils.h>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "lambda_client.h"
+
+namespace AwsLabs::Enhanced {
+
+struct MemoCacheOptions {
+  // Bytes of encoded results kept in memory
+  std::size_t maxBytes = 64 * 1024 * 1024;
+  // Directory keeping results across runs, none when empty
+  std::filesystem::path directory;
+};
+
+// Encoded results of Lambda calls by key, in a least recently used memory tier backed by an optional
+// directory. Calls with the key of a call still in flight wait for its result instead of invoking again.
+// Failures are passed to the waiting calls but not cached.
+class MemoCache {
+public:
+  using Result = expns::expected<Aws::String, std::string>;
+  using Waiter = std::function<void(Result)>;
+
+  struct Statistics {
+    std::size_t hits = 0;      // served from memory
+    std::size_t diskHits = 0;  // served from the directory
+    std::size_t misses = 0;    // invoked
+    std::size_t coalesced = 0; // waited for an identical call in flight
+  };
+
+  explicit MemoCache(MemoCacheOptions options = {}) : options(std::move(options)) {
+    if (!this->options.directory.empty()) {
+      std::error_code ec;
+      std::filesystem::create_directories(this->options.directory, ec);
+    }
+  }
+
+  // Calls w with the result of key once known. Returns true when the caller must compute it and pass it
+  // to complete, false when it was cached or is being computed by another call.
+  bool join(std::string const &key, Waiter w) {
+    {
+      std::unique_lock lock(mutex);
+      if (auto found = index.find(key); found != index.end()) {
+        order.splice(order.begin(), order, found->second);
+        ++statistics.hits;
+        auto value = found->second->second;
+        lock.unlock();
+        w(std::move(value));
+        return false;
+      }
+      auto [waiting, first] = inFlight.try_emplace(key);
+      waiting->second.push_back(std::move(w));
+      if (!first) {
+        ++statistics.coalesced;
+        return false;
+      }
+    }
+    if (auto value = readFile(key)) {
+      {
+        std::lock_guard lock(mutex);
+        ++statistics.diskHits;
+      }
+      finish(key, std::move(*value), false);
+      return false;
+    }
+    std::lock_guard lock(mutex);
+    ++statistics.misses;
+    return true;
+  }
+
+  // Caches the result computed after join returned true and passes it to the calls waiting for it
+  void complete(std::string const &key, Result result) {
+    finish(key, std::move(result), true);
+  }
+
+  Statistics stats() {
+    std::lock_guard lock(mutex);
+    return statistics;
+  }
+
+private:
+  void finish(std::string const &key, Result result, bool write) {
+    if (result && write)
+      writeFile(key, *result);
+    std::vector<Waiter> waiters;
+    {
+      std::lock_guard lock(mutex);
+      if (result)
+        insert(key, *result);
+      waiters = std::move(inFlight[key]);
+      inFlight.erase(key);
+    }
+    for (auto &w : waiters)
+      w(result);
+  }
+
+  void insert(std::string const &key, Aws::String const &value) {
+    auto size = key.size() + value.size();
+    if (size > options.maxBytes || index.count(key))
+      return;
+    order.emplace_front(key, value);
+    index[key] = order.begin();
+    bytes += size;
+    while (bytes > options.maxBytes) {
+      auto &oldest = order.back();
+      bytes -= oldest.first.size() + oldest.second.size();
+      index.erase(oldest.first);
+      order.pop_back();
+    }
+  }
+
+  std::optional<Aws::String> readFile(std::string const &key) const {
+    if (options.directory.empty())
+      return std::nullopt;
+    std::ifstream file(options.directory / key, std::ios::binary);
+    if (!file)
+      return std::nullopt;
+    return Aws::String(std::istreambuf_iterator<char>(file), {});
+  }
+
+  // Renamed into place so concurrent runs never read a partial file. The directory is best effort.
+  void writeFile(std::string const &key, Aws::String const &value) const {
+    if (options.directory.empty())
+      return;
+    std::ostringstream suffix;
+    suffix << ".tmp" << std::this_thread::get_id();
+    auto path = options.directory / key;
+    auto temporary = path;
+    temporary += suffix.str();
+    {
+      std::ofstream file(temporary, std::ios::binary);
+      if (!file.write(value.data(), value.size()))
+        return;
+    }
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+      std::filesystem::remove(temporary, ec);
+  }
+
+  MemoCacheOptions options;
+  std::mutex mutex;
+  std::list<std::pair<std::string, Aws::String>> order; // most recently used first
+  std::unordered_map<std::string, decltype(order)::iterator> index;
+  std::size_t bytes = 0;
+  std::unordered_map<std::string, std::vector<Waiter>> inFlight;
+  Statistics statistics;
+};
+
+namespace Detail {
+// Version and code hash of the function, so a redeployed $LATEST does not hit results of the previous code
+inline std::string functionVersion(EnhancedLambdaClient &client, std::string const &name) {
+  Aws::Lambda::Model::GetFunctionConfigurationRequest request;
+  request.SetFunctionName(toAwsString(name));
+  auto outcome = client.client->GetFunctionConfiguration(request);
+  if (!outcome.IsSuccess())
+    throw std::runtime_error("Cannot resolve the version of " + name + ": " + outcome.GetError().GetMessage().c_str());
+  return toStdString(outcome.GetResult().GetVersion() + ":" + outcome.GetResult().GetCodeSha256());
+}
+
+// The encoded result of an invocation, or the error of the invocation or the function
+inline MemoCache::Result encodedResult(Aws::Lambda::Model::InvokeOutcome &outcome) {
+  if (!outcome.IsSuccess())
+    return expns::unexpected(std::string(outcome.GetError().GetMessage()));
+  auto payload = readPayload(outcome.GetResult());
+  if (outcome.GetResult().GetFunctionError().length())
+    return expns::unexpected(std::string(JsonValue(payload).View().GetString("errorMessage")));
+  if (auto value = stringField(payload, "value"))
+    return Aws::String(*value);
+  auto location = stringField(payload, "value_s3");
+  if (!location)
+    return expns::unexpected(std::string("Response has no value"));
+  // Cached encoded, as results small enough for a payload are
+  try {
+    auto &bytes = codecBuffer();
+    takeOffloaded(parseLocation(*location), bytes);
+    Aws::String base64;
+    base64Encode(bytes.data(), bytes.size(), base64);
+    releaseCodecBuffer(bytes);
+    return base64;
+  } catch (std::exception const &e) {
+    return expns::unexpected(std::string(e.what()));
+  }
+}
+}
+
+template<typename Sig>
+struct Memoized;
+
+// Calls of l looked up in a MemoCache by function name, function version and the SHA-256 of the serialized
+// arguments. Only deterministic functions should be memoized. The version is queried from Lambda unless given.
+template<typename R, typename ...Args>
+struct Memoized<R(Args...)> {
+  Memoized(Lambda<R(Args...)> lambda, std::shared_ptr<MemoCache> cache, std::string version = {})
+      : lambda(lambda), cache(std::move(cache)),
+        version(version.empty() ? Detail::functionVersion(lambda.client, lambda.name) : std::move(version)) {}
+
+  std::string keyOf(Aws::String const &encodedArgs) const {
+    auto function = lambda.function ? "#" + std::to_string(*lambda.function) : std::string();
+    Aws::String identity = Detail::toAwsString(lambda.name + function + '\0' + version + '\0') + encodedArgs;
+    return Detail::toStdString(Aws::Utils::HashingUtils::HexEncode(Aws::Utils::HashingUtils::CalculateSHA256(identity)));
+  }
+
+  template<typename Callable>
+  void invoke_async(Callable c, Args... args) {
+    auto encoded = lambda.encodeArgs(args...);
+    auto key = keyOf(encoded);
+    auto waiter = [c](MemoCache::Result result) {
+      if (!result)
+        return c(expns::expected<R, std::string>(expns::unexpected(result.error())));
+      try {
+        c(expns::expected<R, std::string>(Detail::decode<Detail::ResultHolder<R>>(*result).result));
+      } catch (std::exception const &e) {
+        c(expns::expected<R, std::string>(expns::unexpected(std::string(e.what()))));
+      }
+    };
+    if (!cache->join(key, waiter))
+      return;
+    std::optional<s3location> argument;
+    auto request = lambda.request("serialized", encoded, argument);
+    lambda.client.invokeAsync(
+      request,
+      [cache = cache, key, observe = lambda.observer(), argument](Aws::Lambda::Model::InvokeOutcome outcome) {
+        Detail::deleteArgument(argument);
+        observe(outcome);
+        cache->complete(key, Detail::encodedResult(outcome));
+      });
+  }
+
+  R operator()(Args... args) {
+    std::promise<expns::expected<R, std::string>> promise;
+    auto result = promise.get_future();
+    invoke_async([&promise](expns::expected<R, std::string> e) { promise.set_value(std::move(e)); }, args...);
+    auto e = result.get();
+    if (e)
+      return std::move(*e);
+    throw std::runtime_error(e.error());
+  }
+
+  Lambda<R(Args...)> lambda;
+  std::shared_ptr<MemoCache> cache;
+  std::string version;
+};
+
+template<typename R, typename ...Args>
+Memoized(Lambda<R(Args...)>, std::shared_ptr<MemoCache>, std::string = {}) -> Memoized<R(Args...)>;
+}
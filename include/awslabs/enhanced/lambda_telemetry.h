@@ -0,0 +1,178 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "detail/lambda_detail.h"
+
+namespace AwsLabs::Enhanced {
+
+// The REPORT line Lambda writes at the end of the logs of an invocation
+struct InvocationReport {
+  double durationMs = 0;
+  double billedDurationMs = 0;
+  // Only on the first invocation of a container
+  std::optional<double> initDurationMs;
+  double memorySizeMb = 0;
+  double maxMemoryUsedMb = 0;
+};
+
+namespace Detail {
+// The number after label, e.g. 12.5 after "\tDuration: " in "\tDuration: 12.5 ms"
+inline std::optional<double> reportNumber(std::string const &line, std::string_view label) {
+  auto pos = line.find(label);
+  if (pos == std::string::npos)
+    return std::nullopt;
+  auto start = line.c_str() + pos + label.size();
+  char *end;
+  auto value = std::strtod(start, &end);
+  if (end == start)
+    return std::nullopt;
+  return value;
+}
+
+// Fields of the line are separated by tabs
+inline std::optional<InvocationReport> parseReport(std::string_view logs) {
+  auto start = logs.rfind("REPORT RequestId:");
+  if (start == std::string_view::npos)
+    return std::nullopt;
+  auto end = logs.find('\n', start);
+  std::string line(logs.substr(start, end == std::string_view::npos ? end : end - start));
+  auto duration = reportNumber(line, "\tDuration: ");
+  if (!duration)
+    return std::nullopt;
+  InvocationReport report;
+  report.durationMs = *duration;
+  report.billedDurationMs = reportNumber(line, "\tBilled Duration: ").value_or(0);
+  report.initDurationMs = reportNumber(line, "\tInit Duration: ");
+  report.memorySizeMb = reportNumber(line, "\tMemory Size: ").value_or(0);
+  report.maxMemoryUsedMb = reportNumber(line, "\tMax Memory Used: ").value_or(0);
+  return report;
+}
+}
+
+// Counts of milliseconds in buckets growing by a quarter octave, so percentiles are within 19% from 0.1ms to
+// about 30 hours
+class LatencyHistogram {
+public:
+  static constexpr std::size_t buckets = 4 * 30;
+  static constexpr double lowestMs = 0.1;
+
+  void record(double ms) {
+    ++counts[bucketOf(ms)];
+    ++total;
+    sum += ms;
+    maximum = std::max(maximum, ms);
+  }
+
+  std::size_t count() const { return total; }
+
+  double mean() const { return total ? sum / total : 0; }
+
+  double max() const { return maximum; }
+
+  // Upper bound of the bucket holding the q quantile, 0 <= q <= 1
+  double percentile(double q) const {
+    if (!total)
+      return 0;
+    auto rank = static_cast<std::size_t>(std::ceil(q * total));
+    std::size_t seen = 0;
+    for (std::size_t i = 0; i < buckets; ++i) {
+      seen += counts[i];
+      if (seen >= std::max<std::size_t>(rank, 1))
+        return std::min(upperBound(i), maximum);
+    }
+    return maximum;
+  }
+
+private:
+  static std::size_t bucketOf(double ms) {
+    if (!(ms > lowestMs))
+      return 0;
+    auto i = static_cast<std::size_t>(std::ceil(4 * std::log2(ms / lowestMs)));
+    return std::min(i, buckets - 1);
+  }
+
+  static double upperBound(std::size_t i) { return lowestMs * std::exp2(i / 4.0); }
+
+  std::array<std::size_t, buckets> counts{};
+  std::size_t total = 0;
+  double sum = 0;
+  double maximum = 0;
+};
+
+// Reports of the invocations of bound functions, by function. Clients given one request the log tail of
+// every invocation, up to 4KB of base64 per response, to read its REPORT line.
+class InvocationTelemetry {
+public:
+  struct FunctionMetrics {
+    LatencyHistogram duration;
+    LatencyHistogram billedDuration;
+    LatencyHistogram initDuration; // cold starts only
+    // Functions taking a context: building contexts, recorded when any were built, and the calls using them
+    LatencyHistogram contextInit;
+    LatencyHistogram contextCall;
+    double memorySizeMb = 0;
+    double maxMemoryUsedMb = 0;   // over all invocations
+    std::size_t unreported = 0;   // responses without a REPORT line
+  };
+
+  void record(std::string const &function, std::optional<InvocationReport> const &report) {
+    std::lock_guard lock(mutex);
+    auto &metrics = functions[function];
+    if (!report) {
+      ++metrics.unreported;
+      return;
+    }
+    metrics.duration.record(report->durationMs);
+    metrics.billedDuration.record(report->billedDurationMs);
+    if (report->initDurationMs)
+      metrics.initDuration.record(*report->initDurationMs);
+    metrics.memorySizeMb = report->memorySizeMb;
+    metrics.maxMemoryUsedMb = std::max(metrics.maxMemoryUsedMb, report->maxMemoryUsedMb);
+  }
+
+  void recordContext(std::string const &function, double initMs, double callMs) {
+    std::lock_guard lock(mutex);
+    auto &metrics = functions[function];
+    if (initMs > 0)
+      metrics.contextInit.record(initMs);
+    metrics.contextCall.record(callMs);
+  }
+
+  // Records the REPORT line in the base64 log tail of a response
+  void recordLogTail(std::string const &function, std::string_view base64) {
+    std::optional<InvocationReport> report;
+    try {
+      std::vector<uint8_t> logs;
+      Detail::base64Decode(base64, logs);
+      report = Detail::parseReport(std::string_view(reinterpret_cast<char const *>(logs.data()), logs.size()));
+    } catch (std::exception const &) {
+    }
+    record(function, report);
+  }
+
+  std::map<std::string, FunctionMetrics> snapshot() {
+    std::lock_guard lock(mutex);
+    return functions;
+  }
+
+private:
+  std::mutex mutex;
+  std::map<std::string, FunctionMetrics> functions;
+};
+}
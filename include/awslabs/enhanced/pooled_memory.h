@@ -0,0 +1,275 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <aws/core/Aws.h>
+#include <aws/core/utils/memory/MemorySystemInterface.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+namespace Detail {
+/**
+ * Precedes every block handed out, so FreeMemory finds the size class and the start of the allocation.
+ */
+struct alignas(16) block_header {
+  std::uint32_t size_class;
+  std::uint32_t offset; // from the start of the allocation to the block, for large blocks
+};
+
+constexpr std::size_t min_pooled_class = 5;  // 32 bytes
+constexpr std::size_t max_pooled_class = 16; // 64KiB
+constexpr std::size_t pooled_classes = max_pooled_class - min_pooled_class + 1;
+constexpr std::uint32_t large_block = ~std::uint32_t(0);
+
+/**
+ * Counters of one thread, written only by their thread.
+ */
+struct memory_counters {
+  std::atomic<std::size_t> allocations = 0;
+  std::atomic<std::size_t> frees = 0;
+  std::atomic<std::size_t> cache_hits = 0;
+  std::atomic<std::size_t> refills = 0;
+  std::atomic<std::size_t> large_allocations = 0;
+
+  static void bump(std::atomic<std::size_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * Blocks moved between the thread caches, protected by one mutex per size class.
+ */
+struct central_pool {
+  struct size_class_pool {
+    std::mutex mutex;
+    std::vector<void *> blocks;
+  };
+  std::array<size_class_pool, pooled_classes> classes;
+
+  std::mutex counters_mutex;
+  std::vector<const memory_counters *> live;
+  std::array<std::size_t, 5> retired{};
+
+  static central_pool &instance() {
+    static auto pool = new central_pool(); // never destroyed, threads may free memory during static destruction
+    return *pool;
+  }
+};
+
+inline std::size_t cached_blocks_limit(std::size_t size_class) {
+  return std::max<std::size_t>(8, (256 * 1024) >> (size_class + min_pooled_class));
+}
+
+/**
+ * Free lists of one thread. Blocks freed by the thread go back to its own cache, whatever thread allocated them.
+ * Caches exchange half of their blocks with the central pool when they run empty or full.
+ */
+class thread_cache {
+  std::array<std::vector<void *>, pooled_classes> _blocks;
+  static inline thread_local bool exited = false;
+
+public:
+  memory_counters counters;
+
+  thread_cache() {
+    auto &central = central_pool::instance();
+    std::lock_guard lock(central.counters_mutex);
+    central.live.push_back(&counters);
+  }
+
+  ~thread_cache() {
+    exited = true;
+    auto &central = central_pool::instance();
+    for (std::size_t c = 0; c < pooled_classes; ++c) {
+      auto &pool = central.classes[c];
+      std::lock_guard lock(pool.mutex);
+      pool.blocks.insert(pool.blocks.end(), _blocks[c].begin(), _blocks[c].end());
+    }
+    std::lock_guard lock(central.counters_mutex);
+    central.live.erase(std::find(central.live.begin(), central.live.end(), &counters));
+    central.retired[0] += counters.allocations;
+    central.retired[1] += counters.frees;
+    central.retired[2] += counters.cache_hits;
+    central.retired[3] += counters.refills;
+    central.retired[4] += counters.large_allocations;
+  }
+
+  void *pop(std::size_t size_class) {
+    auto &blocks = _blocks[size_class];
+    if (blocks.empty()) {
+      auto &pool = central_pool::instance().classes[size_class];
+      std::lock_guard lock(pool.mutex);
+      auto take = std::min(pool.blocks.size(), cached_blocks_limit(size_class) / 2);
+      blocks.insert(blocks.end(), pool.blocks.end() - take, pool.blocks.end());
+      pool.blocks.resize(pool.blocks.size() - take);
+      if (take) {
+        memory_counters::bump(counters.refills);
+      }
+    }
+    if (blocks.empty()) {
+      return nullptr;
+    }
+    auto block = blocks.back();
+    blocks.pop_back();
+    memory_counters::bump(counters.cache_hits);
+    return block;
+  }
+
+  void push(std::size_t size_class, void *block) {
+    auto &blocks = _blocks[size_class];
+    if (blocks.size() >= cached_blocks_limit(size_class)) {
+      auto give = blocks.size() / 2;
+      auto &pool = central_pool::instance().classes[size_class];
+      std::lock_guard lock(pool.mutex);
+      pool.blocks.insert(pool.blocks.end(), blocks.end() - give, blocks.end());
+      blocks.resize(blocks.size() - give);
+    }
+    blocks.push_back(block);
+  }
+
+  /**
+   * The cache of the calling thread, nullptr once it was destroyed at thread exit.
+   * @return
+   */
+  static thread_cache *local() {
+    if (exited) {
+      return nullptr;
+    }
+    static thread_local thread_cache cache;
+    return &cache;
+  }
+};
+}
+
+/**
+ * SDK memory manager serving small allocations from thread local free lists of power of two size classes,
+ * so request objects, header maps and response buffers allocated at a high rate do not contend on malloc.
+ * Allocations above 64KiB or with an alignment above 16 go to malloc.
+ * Pooled memory is never returned to the system.
+ *
+ * It takes effect only when the SDK was built with custom memory management (-DCUSTOM_MEMORY_MANAGEMENT=ON),
+ * and must be installed before Aws::InitAPI, e.g. AwsApi api(with_pooled_memory()).
+ */
+class pooled_memory_system : public Aws::Utils::Memory::MemorySystemInterface {
+public:
+  struct statistics {
+    std::size_t allocations = 0;       // calls to AllocateMemory
+    std::size_t frees = 0;             // calls to FreeMemory
+    std::size_t cache_hits = 0;        // allocations served from a thread cache
+    std::size_t refills = 0;           // thread caches refilled from the central pool
+    std::size_t large_allocations = 0; // allocations passed to malloc
+  };
+
+  void Begin() override {}
+
+  void End() override {}
+
+  void *AllocateMemory(std::size_t blockSize, std::size_t alignment, const char * = nullptr) override {
+    using namespace Detail;
+    auto cache = thread_cache::local();
+    if (cache) {
+      memory_counters::bump(cache->counters.allocations);
+    }
+    auto size_class = std::max<std::size_t>(std::bit_width(std::max<std::size_t>(blockSize, 1) - 1), min_pooled_class);
+    if (size_class > max_pooled_class || alignment > alignof(block_header)) {
+      if (cache) {
+        memory_counters::bump(cache->counters.large_allocations);
+      }
+      alignment = std::max(alignment, alignof(block_header));
+      auto raw = static_cast<char *>(std::malloc(blockSize + alignment + sizeof(block_header)));
+      if (!raw) {
+        return nullptr;
+      }
+      auto address = reinterpret_cast<std::uintptr_t>(raw + sizeof(block_header));
+      auto block = raw + sizeof(block_header) + (alignment - address % alignment) % alignment;
+      auto header = reinterpret_cast<block_header *>(block) - 1;
+      header->size_class = large_block;
+      header->offset = static_cast<std::uint32_t>(block - raw);
+      return block;
+    }
+    auto index = size_class - min_pooled_class;
+    auto block = cache ? cache->pop(index) : nullptr;
+    if (!block) {
+      auto raw = std::malloc(sizeof(block_header) + (std::size_t(1) << size_class));
+      if (!raw) {
+        return nullptr;
+      }
+      auto header = static_cast<block_header *>(raw);
+      header->size_class = static_cast<std::uint32_t>(index);
+      header->offset = sizeof(block_header);
+      block = header + 1;
+    }
+    return block;
+  }
+
+  void FreeMemory(void *memoryPtr) override {
+    using namespace Detail;
+    if (!memoryPtr) {
+      return;
+    }
+    auto cache = thread_cache::local();
+    auto header = static_cast<block_header *>(memoryPtr) - 1;
+    if (cache) {
+      memory_counters::bump(cache->counters.frees);
+    }
+    if (header->size_class == large_block) {
+      std::free(static_cast<char *>(memoryPtr) - header->offset);
+    } else if (cache) {
+      cache->push(header->size_class, memoryPtr);
+    } else {
+      auto &pool = central_pool::instance().classes[header->size_class];
+      std::lock_guard lock(pool.mutex);
+      pool.blocks.push_back(memoryPtr);
+    }
+  }
+
+  /**
+   * Counters summed over all threads, including the ones that exited.
+   * @return
+   */
+  static statistics stats() {
+    auto &central = Detail::central_pool::instance();
+    std::lock_guard lock(central.counters_mutex);
+    statistics stats{central.retired[0], central.retired[1], central.retired[2], central.retired[3], central.retired[4]};
+    for (auto counters : central.live) {
+      stats.allocations += counters->allocations;
+      stats.frees += counters->frees;
+      stats.cache_hits += counters->cache_hits;
+      stats.refills += counters->refills;
+      stats.large_allocations += counters->large_allocations;
+    }
+    return stats;
+  }
+
+  /**
+   * The memory manager installed by with_pooled_memory. Never destroyed, as the SDK frees memory
+   * during static destruction.
+   * @return
+   */
+  static pooled_memory_system &instance() {
+    static auto memory_system = new pooled_memory_system();
+    return *memory_system;
+  }
+};
+
+/**
+ * Returns options installing pooled_memory_system::instance() as the SDK memory manager.
+ * @param options
+ * @return
+ */
+inline Aws::SDKOptions with_pooled_memory(Aws::SDKOptions options = {}) {
+  options.memoryManagementOptions.memoryManager = &pooled_memory_system::instance();
+  return options;
+}
+}
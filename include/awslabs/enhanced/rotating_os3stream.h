@@ -0,0 +1,303 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef S3STREAM_INCLUDE_ROTATING_OS3STREAM_H
+#define S3STREAM_INCLUDE_ROTATING_OS3STREAM_H
+
+#include <awslabs/enhanced/executor.h>
+#include <awslabs/enhanced/os3stream.h>
+#include <aws/core/client/ClientConfiguration.h>
+#include <aws/s3/S3Client.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+namespace AwsLabs::Enhanced {
+
+/**
+ * When a rotating_os3stream cuts the current object and starts the next one.
+ */
+struct rotation_policy {
+  /**
+   * Objects are cut once they reach this many bytes.
+   */
+  std::size_t max_bytes = 64 * 1024 * 1024;
+  /**
+   * Objects are cut once this much time passed since their first byte was written.
+   * The age is checked when writing or flushing.
+   */
+  std::chrono::seconds max_age = std::chrono::seconds(300);
+  /**
+   * Cut objects only after a newline, so lines are never split between objects.
+   */
+  bool line_aligned = true;
+};
+
+namespace Detail {
+/**
+ * streambuf forwarding to the current os3stream and closing the previous ones in a background thread.
+ */
+class rotating_s3buf : public std::streambuf {
+  using clock = std::chrono::steady_clock;
+
+  std::shared_ptr<Aws::S3::S3Client> _client;
+  std::string _region;
+  std::string _bucket_name;
+  std::string _key_template;
+  rotation_policy _policy;
+
+  std::unique_ptr<os3stream> _current; // opened on the first byte of every object
+  std::size_t _written = 0;
+  clock::time_point _opened;
+  std::size_t _sequence = 0;
+  std::atomic<std::size_t> _rotations = 0;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::unique_ptr<os3stream>> _closing;
+  std::size_t _failed = 0;
+  bool _stop = false;
+  std::thread _closer;
+
+  void close_in_background() {
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [&] { return _stop || !_closing.empty(); });
+      if (_closing.empty()) {
+        return;
+      }
+      auto os3s = std::move(_closing.front());
+      lock.unlock();
+      os3s->close();
+      bool failed = os3s->fail();
+      os3s = nullptr;
+      lock.lock();
+      _closing.pop_front();
+      _failed += failed;
+      _cv.notify_all();
+    }
+  }
+
+  std::string object_name() {
+    auto name = _key_template;
+    auto replace = [&](const std::string &placeholder, const std::string &value) {
+      for (auto pos = name.find(placeholder); pos != std::string::npos; pos = name.find(placeholder, pos)) {
+        name.replace(pos, placeholder.size(), value);
+        pos += value.size();
+      }
+    };
+    char sequence[24];
+    std::snprintf(sequence, sizeof(sequence), "%08zu", _sequence);
+    replace("{seq}", sequence);
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm utc{};
+    gmtime_r(&now, &utc);
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y%m%dT%H%M%SZ", &utc);
+    replace("{timestamp}", timestamp);
+    return name;
+  }
+
+  void open_next() {
+    _current = std::make_unique<os3stream>();
+    _current->rdbuf()->set_client(_client);
+    _current->open(_region, _bucket_name, object_name());
+    ++_sequence;
+    _written = 0;
+    _opened = clock::now();
+  }
+
+  bool expired() const {
+    return _current && clock::now() - _opened >= _policy.max_age;
+  }
+
+protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    std::streamsize done = 0;
+    while (done < n) {
+      if (expired()) {
+        rotate();
+      }
+      if (!_current) {
+        open_next();
+      }
+      auto chunk = n - done;
+      bool cut = false;
+      if (_written + chunk >= _policy.max_bytes) {
+        auto threshold = static_cast<std::streamsize>(_written < _policy.max_bytes ? _policy.max_bytes - _written : 0);
+        if (!_policy.line_aligned) {
+          chunk = std::max<std::streamsize>(threshold, 1);
+          cut = true;
+        } else if (auto newline = std::memchr(s + done + threshold, '\n', chunk - threshold)) {
+          chunk = static_cast<const char *>(newline) - (s + done) + 1;
+          cut = true;
+        }
+      }
+      _current->rdbuf()->sputn(s + done, chunk);
+      _written += chunk;
+      done += chunk;
+      if (cut) {
+        rotate();
+      }
+    }
+    return n;
+  }
+
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      char_type ch = traits_type::to_char_type(c);
+      xsputn(&ch, 1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    if (expired()) {
+      rotate();
+    }
+    return 0;
+  }
+
+public:
+  rotating_s3buf(const std::string &region,
+                 const std::string &bucket_name,
+                 const std::string &key_template,
+                 rotation_policy policy)
+      : _region(region), _bucket_name(bucket_name), _key_template(key_template), _policy(policy) {
+    Aws::Client::ClientConfiguration config;
+    config.region = region;
+    config.executor = shared_executor();
+    _client = std::make_shared<Aws::S3::S3Client>(config);
+    _closer = std::thread([this] { close_in_background(); });
+  }
+
+  ~rotating_s3buf() override {
+    rotate();
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+      _cv.notify_all();
+    }
+    _closer.join();
+  }
+
+  /**
+   * Hands the current object to the background closer. The next write starts a new object.
+   */
+  void rotate() {
+    if (!_current) {
+      return;
+    }
+    std::lock_guard lock(_mutex);
+    _closing.push_back(std::move(_current));
+    ++_rotations;
+    _cv.notify_all();
+  }
+
+  /**
+   * Blocks until every object handed to the background closer is uploaded.
+   */
+  void wait() {
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [&] { return _closing.empty(); });
+  }
+
+  std::size_t rotations() const {
+    return _rotations;
+  }
+
+  std::size_t failed_uploads() {
+    std::lock_guard lock(_mutex);
+    return _failed;
+  }
+};
+}
+
+/**
+ * Output stream writing to a sequence of S3 objects, cutting the current object once it reaches a size
+ * or an age. Cut objects are uploaded in a background thread while writes continue into the next object,
+ * so rotating does not stall the writer.
+ *
+ * Object names come from a template where {seq} is replaced by the zero padded sequence number of the
+ * object and {timestamp} by the UTC time its first byte was written, e.g. "logs/app-{timestamp}-{seq}.log".
+ * No object is created until something is written to it.
+ */
+class rotating_os3stream : public std::ostream {
+  Detail::rotating_s3buf _buf;
+public:
+  /**
+   * Construct a rotating_os3stream writing objects named after key_template in bucket_name.
+   * @param region
+   * @param bucket_name
+   * @param key_template
+   * @param policy
+   */
+  rotating_os3stream(const std::string &region,
+                     const std::string &bucket_name,
+                     const std::string &key_template,
+                     rotation_policy policy = {})
+      : std::ostream(nullptr), _buf(region, bucket_name, key_template, policy) {
+    rdbuf(&_buf);
+  }
+
+  rotating_os3stream(const rotating_os3stream &) = delete;
+  rotating_os3stream &operator=(const rotating_os3stream &) = delete;
+
+  /**
+   * Cuts the current object now. Does nothing if nothing was written since the last cut.
+   */
+  void rotate() {
+    _buf.rotate();
+  }
+
+  /**
+   * Cuts the current object and waits until every object is uploaded.
+   * Sets failbit if any upload failed.
+   */
+  void close() {
+    _buf.rotate();
+    _buf.wait();
+    if (_buf.failed_uploads()) {
+      std::ios::setstate(failbit);
+    }
+  }
+
+  /**
+   * Number of objects cut so far.
+   * @return
+   */
+  std::size_t rotations() const {
+    return _buf.rotations();
+  }
+
+  /**
+   * Number of objects whose upload failed.
+   * @return
+   */
+  std::size_t failed_uploads() {
+    return _buf.failed_uploads();
+  }
+
+  /**
+   * Uploads every pending object before destroying the stream.
+   */
+  virtual ~rotating_os3stream() {
+    try {
+      close();
+    } catch (...) {
+      // Don't throw from destructors
+    }
+  }
+};
+}
+
+#endif //S3STREAM_INCLUDE_ROTATING_OS3STREAM_H
@@ -7,9 +7,13 @@
 #include <aws/s3/S3Client.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/PutObjectRequest.h>
+#include <awslabs/enhanced/executor.h>
+#include <awslabs/enhanced/s3buffer_governor.h>
+#include <awslabs/enhanced/detail/aws_string.h>
 #include <streambuf>
 #include <variant>
 #include <memory>
+#include <future>
 
 namespace AwsLabs::Enhanced {
 
@@ -21,17 +25,35 @@ struct s3location {
   std::string object;
 };
 
+/**
+ * When opening for reading issues the GetObject request.
+ * eager waits for the response before open returns, lazy defers the request until the first read,
+ * and async starts the request and returns without waiting for the response.
+ */
+enum class s3open_policy {
+  eager,
+  lazy,
+  async
+};
+
 class s3buf : public std::streambuf {
   using get_outcome_t = Aws::S3::Model::GetObjectOutcome;
-  using internal_gbuf_t = std::variant<get_outcome_t>;
+  using deferred_get_t = Aws::S3::Model::GetObjectRequest;
+  using pending_get_t = std::future<get_outcome_t>;
+  using internal_gbuf_t = std::variant<get_outcome_t, deferred_get_t, pending_get_t>;
 
   std::unique_ptr <internal_gbuf_t> internal_gbuf = nullptr;
   std::shared_ptr <std::stringstream> internal_pbuf = nullptr;
   char *get_buffer = nullptr;
   char *put_buffer = nullptr;
   const size_t buffer_size = 64;
+  const void *buffer_owner = this; // governor accounting key, travels with the buffers when swapped
+  std::size_t committed = 0;        // bytes of internal_pbuf or of the response body accounted to buffer_owner
+  std::size_t written = 0;          // bytes in internal_pbuf
+  bool write_failed = false;        // memory for written bytes was refused, the object is not uploaded
+  s3exhaustion exhaustion = s3exhaustion::block;
   std::unique_ptr <s3location> _object_loc = nullptr; //location  of the s3 object
-  std::unique_ptr <Aws::S3::S3Client> s3_client = nullptr;
+  std::shared_ptr <Aws::S3::S3Client> s3_client = nullptr;
 public:
   using char_type = std::streambuf::char_type;
   using traits_type = std::streambuf::traits_type;
@@ -54,12 +76,8 @@ public:
    * s3b content is acquired.
    * @param s3b
    */
-  s3buf(s3buf &&s3b) {
-    std::swap(internal_gbuf, s3b.internal_gbuf); //current internal_gbuf is nullptr thus no need to clean it
-    std::swap(get_buffer, s3b.get_buffer); //current get_buffer is nullptr thus no need to clean it
-    //get the pointers, they need no corrections because get_buffer is outside the object
-    setg(s3b.eback(), s3b.gptr(), s3b.egptr());
-    s3b.setg(nullptr, nullptr, nullptr);
+  s3buf(s3buf &&s3b) : s3buf() {
+    swap(s3b); //the buffers and the memory accounted for them travel with buffer_owner
   }
   /**
    * Move assignment closes s3b before acquiring its contents.
@@ -76,24 +94,30 @@ public:
    */
   virtual ~s3buf() {
     close();
-    if (get_buffer) {
-      delete[] get_buffer;
-    }
-    if (put_buffer) {
-      delete[] put_buffer;
-    }
+    release_buffer(get_buffer);
+    release_buffer(put_buffer);
   }
   /**
    * Associates the S3 bucket and object to be read/written by the s3buf.
    * Only ios_base::in and ios_base::out are valid values, everything else will fail the operation.
    * Opening an already opened s3buf fails.
-   * Return is *this in success, and nullptr in failure
+   * Return is *this in success, and nullptr in failure.
+   * For reading, policy selects when the object is requested. With lazy and async policies open succeeds
+   * before the object is known to exist, a failed request shows as an empty object on the first read.
+   * Buffers, the object being written and the response body are accounted to the s3buffer_governor. With
+   * s3exhaustion::degrade (see set_exhaustion) open fails when the governor cannot grant the buffers,
+   * and writes fail when it cannot grant room for the object, so the caller can fall back to a serial path.
    *
    * @param bucket_name
    * @param object_name
+   * @param policy
    * @return
    */
-  s3buf *open(const char *region, const char *bucket_name, const char *object_name, std::ios_base::openmode mode) {
+  s3buf *open(const char *region,
+              const char *bucket_name,
+              const char *object_name,
+              std::ios_base::openmode mode,
+              s3open_policy policy = s3open_policy::eager) {
     _object_loc = std::make_unique<s3location>(region, bucket_name, object_name);
     if (is_open()) {
       return nullptr; // Already opened
@@ -101,24 +125,43 @@ public:
     if (!s3_client) {
       Aws::Client::ClientConfiguration config;
       config.region = _object_loc->region;
-      s3_client = std::make_unique<Aws::S3::S3Client>(config);
+      config.executor = shared_executor();
+      s3_client = std::make_shared<Aws::S3::S3Client>(config);
     }
     if (std::ios_base::out == mode) {
-      put_buffer = new char[buffer_size]();
+      put_buffer = acquire_buffer();
+      if (!put_buffer) {
+        return nullptr;
+      }
       setp(put_buffer, put_buffer + buffer_size);
+      written = 0;
+      write_failed = false;
       return this;
     } else if (std::ios_base::in == mode) {
       //TODO download file in parts
       Aws::S3::Model::GetObjectRequest get_request;
-      get_request.SetBucket(_object_loc->bucket);
-      get_request.SetKey(_object_loc->object);
+      get_request.SetBucket(Detail::toAwsString(_object_loc->bucket));
+      get_request.SetKey(Detail::toAwsString(_object_loc->object));
+      //acquired before the request, which must not be abandoned once started
+      get_buffer = acquire_buffer();
+      if (!get_buffer) {
+        return nullptr;
+      }
 
+      if (policy == s3open_policy::lazy) {
+        internal_gbuf = std::make_unique<internal_gbuf_t>(std::move(get_request));
+        return this;
+      } else if (policy == s3open_policy::async) {
+        internal_gbuf = std::make_unique<internal_gbuf_t>(s3_client->GetObjectCallable(get_request));
+        return this;
+      }
       internal_gbuf = std::make_unique<internal_gbuf_t>(s3_client->GetObject(get_request));
       if (get_if<get_outcome_t>(&*internal_gbuf)->IsSuccess()) {
-        get_buffer = new char[buffer_size]();
+        commit_body();
         return this;
       } else {
         internal_gbuf = nullptr;
+        release_buffer(get_buffer);
         return nullptr;
       }
     } else {
@@ -131,13 +174,52 @@ public:
    * @param bucket_name
    * @param object_name
    * @param mode
+   * @param policy
    * @return
    */
   s3buf *open(const std::string &region,
               const std::string &bucket_name,
               const std::string &object_name,
-              std::ios_base::openmode mode) {
-    return open(region.c_str(), bucket_name.c_str(), object_name.c_str(), mode);
+              std::ios_base::openmode mode,
+              s3open_policy policy = s3open_policy::eager) {
+    return open(region.c_str(), bucket_name.c_str(), object_name.c_str(), mode, policy);
+  }
+
+  /**
+   * Waits for the GetObject request of an object opened for reading, issuing it first if it was deferred.
+   * Returns *this if the object was retrieved and nullptr if the request failed or nothing is open for reading.
+   * @return
+   */
+  s3buf *wait_open() {
+    if (!internal_gbuf) {
+      return nullptr;
+    }
+    if (auto deferred = std::get_if<deferred_get_t>(&*internal_gbuf)) {
+      internal_gbuf = std::make_unique<internal_gbuf_t>(s3_client->GetObject(*deferred));
+      commit_body();
+    } else if (auto pending = std::get_if<pending_get_t>(&*internal_gbuf)) {
+      internal_gbuf = std::make_unique<internal_gbuf_t>(pending->get());
+      commit_body();
+    }
+    return std::get<get_outcome_t>(*internal_gbuf).IsSuccess() ? this : nullptr;
+  }
+
+  /**
+   * Sets the client used by the following open calls instead of creating one for the object region.
+   * Sharing a client avoids paying its construction on every open.
+   * @param client
+   */
+  void set_client(std::shared_ptr <Aws::S3::S3Client> client) {
+    s3_client = std::move(client);
+  }
+
+  /**
+   * Sets what the following open calls and writes do when the s3buffer_governor cannot grant memory:
+   * block until other streams release it, or fail so the caller can degrade to a serial path.
+   * @param policy
+   */
+  void set_exhaustion(s3exhaustion policy) {
+    exhaustion = policy;
   }
 
   /**
@@ -154,9 +236,14 @@ public:
    */
   s3buf *close() {
     if (get_buffer) {
+      if (internal_gbuf) {
+        if (auto pending = std::get_if<pending_get_t>(&*internal_gbuf)) {
+          pending->wait(); // the request refers to s3_client
+        }
+      }
       internal_gbuf = nullptr;
-      delete[] get_buffer;
-      get_buffer = nullptr;
+      release_committed();
+      release_buffer(get_buffer);
       setg(nullptr, nullptr, nullptr);
       return this;
     } else if (put_buffer) {
@@ -164,19 +251,22 @@ public:
       if (!internal_pbuf) {
         internal_pbuf = std::make_shared<std::stringstream>();
       }
-      for (auto it = pbase(); it < pptr(); ++it) {
-        internal_pbuf->put(*it);
-      }
-      delete[] put_buffer;
-      put_buffer = nullptr;
+      flush_put_area();
+      release_buffer(put_buffer);
       setp(nullptr, nullptr);
+      if (write_failed) {
+        internal_pbuf = nullptr;
+        release_committed();
+        return nullptr;
+      }
       //TODO upload file in parts
       Aws::S3::Model::PutObjectRequest put_request;
-      put_request.SetBucket(_object_loc->bucket);
-      put_request.SetKey(_object_loc->object);
+      put_request.SetBucket(Detail::toAwsString(_object_loc->bucket));
+      put_request.SetKey(Detail::toAwsString(_object_loc->object));
       put_request.SetBody(internal_pbuf);
       auto outcome = s3_client->PutObject(put_request);
       internal_pbuf = nullptr;
+      release_committed();
       if (outcome.IsSuccess()) {
         return this;
       } else {
@@ -192,16 +282,89 @@ public:
  */
   void swap(s3buf &s3b) {
     std::swap(internal_gbuf, s3b.internal_gbuf);
+    std::swap(internal_pbuf, s3b.internal_pbuf);
     std::swap(get_buffer, s3b.get_buffer);
     std::swap(_object_loc, s3b._object_loc);
     std::swap(put_buffer, s3b.put_buffer);
+    std::swap(s3_client, s3b.s3_client);
+    std::swap(buffer_owner, s3b.buffer_owner);
+    std::swap(committed, s3b.committed);
+    std::swap(written, s3b.written);
+    std::swap(write_failed, s3b.write_failed);
+    std::swap(exhaustion, s3b.exhaustion);
     char *b = s3b.eback();
     char *n = s3b.gptr();
     char *e = s3b.egptr();
     s3b.setg(eback(), gptr(), egptr());
     setg(b, n, e);
+    char *pb = s3b.pbase();
+    auto pn = s3b.pptr() - pb;
+    char *pe = s3b.epptr();
+    s3b.setp(pbase(), epptr());
+    s3b.pbump(static_cast<int>(pptr() - pbase()));
+    setp(pb, pe);
+    pbump(static_cast<int>(pn));
   }
 protected:
+  /**
+   * Get and put areas are acquired from the process wide s3buffer_governor, which recycles them.
+   * @return
+   */
+  char *acquire_buffer() {
+    return s3buffer_governor::instance().allocate(buffer_owner, buffer_size, exhaustion);
+  }
+  void release_buffer(char *&buffer) {
+    if (buffer) {
+      s3buffer_governor::instance().deallocate(buffer_owner, buffer, buffer_size);
+      buffer = nullptr;
+    }
+  }
+  /**
+   * The response body is held in memory once it arrived, so it is accounted regardless of the ceiling.
+   */
+  void commit_body() {
+    auto outcome = std::get_if<get_outcome_t>(&*internal_gbuf);
+    if (outcome && outcome->IsSuccess() && outcome->GetResult().GetContentLength() > 0) {
+      auto bytes = static_cast<std::size_t>(outcome->GetResult().GetContentLength());
+      s3buffer_governor::instance().commit(buffer_owner, bytes);
+      committed += bytes;
+    }
+  }
+  void release_committed() {
+    if (committed) {
+      s3buffer_governor::instance().release(buffer_owner, committed);
+      committed = 0;
+    }
+    written = 0;
+  }
+  /**
+   * Moves the put area into internal_pbuf. Room is reserved ahead, doubling like the capacity of
+   * internal_pbuf, so the governor is asked about once per doubling.
+   * @return whether the governor granted the room
+   */
+  bool flush_put_area() {
+    auto bytes = static_cast<std::size_t>(pptr() - pbase());
+    if (write_failed) {
+      return false;
+    }
+    if (written + bytes > committed) {
+      auto &governor = s3buffer_governor::instance();
+      auto needed = written + bytes - committed;
+      auto grow = std::max(needed, std::max(committed, buffer_size));
+      if (grow > needed && !governor.reserve(buffer_owner, grow, s3exhaustion::degrade)) {
+        grow = needed; // near the ceiling, only what is written
+      }
+      if (grow == needed && !governor.reserve(buffer_owner, grow, exhaustion)) {
+        write_failed = true;
+        return false;
+      }
+      committed += grow;
+    }
+    internal_pbuf->write(pbase(), static_cast<std::streamsize>(bytes));
+    written += bytes;
+    setp(put_buffer, put_buffer + buffer_size);
+    return true;
+  }
   /**
    * if nothing left to read returns eof
    * if stuff available in internal_gbuf, it is moved to the get_buffer and the first character returned
@@ -209,8 +372,9 @@ protected:
    */
   virtual int_type underflow() override {
     if (internal_gbuf) {
+      wait_open();
       auto outcome = std::get_if<get_outcome_t>(&*internal_gbuf);
-      if (outcome) {
+      if (outcome && outcome->IsSuccess()) {
         int pos = 0;
         while (pos < buffer_size) {
           if (!outcome->GetResult().GetBody().eof()) {
@@ -233,12 +397,13 @@ protected:
     if (!internal_pbuf) {
       internal_pbuf = std::make_shared<std::stringstream>();
     }
-    for (auto it = pbase(); it < pptr(); ++it) {
-      internal_pbuf->put(*it);
+    if (!flush_put_area()) {
+      return traits_type::eof();
     }
-    setp(put_buffer, put_buffer + buffer_size);
-    sputc(c);
-    return c;
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      sputc(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
   }
 };
 }
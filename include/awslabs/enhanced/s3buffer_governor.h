@@ -0,0 +1,303 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef S3STREAM_INCLUDE_S3BUFFER_GOVERNOR_H
+#define S3STREAM_INCLUDE_S3BUFFER_GOVERNOR_H
+
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+/**
+ * What a request for buffer memory does when the governor ceiling is reached.
+ * block waits until other buffers are released, degrade fails immediately so the caller can fall back
+ * to a path that needs less memory, e.g. working serially.
+ */
+enum class s3exhaustion {
+  block,
+  degrade
+};
+
+/**
+ * Process wide accounting of the memory held by s3 stream buffers.
+ * Every stream (owner) acquires its buffers from the governor, which enforces a byte ceiling shared
+ * fairly between owners: while an owner below its fair share (ceiling / owners) waits, owners above
+ * their share are not granted more. Released buffers are kept in per size class pools and recycled.
+ */
+class s3buffer_governor {
+public:
+  struct statistics {
+    std::size_t in_use = 0;      // bytes accounted to owners
+    std::size_t pooled = 0;      // bytes kept for recycling
+    std::size_t allocations = 0; // buffers that had to be allocated
+    std::size_t recycled = 0;    // buffers served from the pool
+    std::size_t blocked = 0;     // requests that waited for memory
+    std::size_t degraded = 0;    // requests refused with s3exhaustion::degrade
+    std::size_t overdrawn = 0;   // blocking requests granted past the ceiling, see reserve
+  };
+
+private:
+  static constexpr std::size_t min_class_size = 64;
+
+  std::mutex _mutex;
+  std::condition_variable _released;
+  std::size_t _ceiling = std::numeric_limits<std::size_t>::max();
+  std::size_t _max_pooled = 64 * 1024 * 1024;
+  std::unordered_map<const void *, std::size_t> _usage;   // owners holding or waiting for memory
+  std::unordered_map<const void *, std::size_t> _waiting; // number of waiting requests per owner
+  std::unordered_map<const void *, std::thread::id> _threads; // thread that last acquired memory per owner
+  std::size_t _starving = 0; // waiters below their fair share
+  std::vector<std::vector<char *>> _pool;
+  statistics _stats;
+
+  static std::size_t size_class(std::size_t bytes) {
+    return std::bit_width(std::max(bytes, min_class_size) - 1);
+  }
+
+  std::size_t fair_share(const void *owner) const {
+    auto owners = _usage.size() + (_usage.count(owner) ? 0 : 1);
+    return _ceiling / owners;
+  }
+
+  std::size_t usage(const void *owner) const {
+    auto it = _usage.find(owner);
+    return it == _usage.end() ? 0 : it->second;
+  }
+
+  bool grantable(const void *owner, std::size_t bytes) const {
+    if (_stats.in_use == 0) {
+      return true; // a lone request larger than the ceiling would otherwise never be served
+    }
+    if (_stats.in_use + bytes > _ceiling) {
+      return false;
+    }
+    return usage(owner) + bytes <= fair_share(owner) || _starving == 0;
+  }
+
+  void account(const void *owner, std::size_t bytes) {
+    _usage[owner] += bytes;
+    _threads[owner] = std::this_thread::get_id();
+    _stats.in_use += bytes;
+  }
+
+  // Whether the calling thread acquired memory for other owners, e.g. streams it has open, which it would
+  // never release while waiting
+  bool holds_other(const void *owner) const {
+    auto self = std::this_thread::get_id();
+    for (auto &[other, bytes] : _usage) {
+      if (other != owner && bytes) {
+        auto thread = _threads.find(other);
+        if (thread != _threads.end() && thread->second == self) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  bool reserve(std::unique_lock<std::mutex> &lock, const void *owner, std::size_t bytes, s3exhaustion policy) {
+    if (grantable(owner, bytes)) {
+      account(owner, bytes);
+      return true;
+    }
+    if (policy == s3exhaustion::degrade) {
+      ++_stats.degraded;
+      return false;
+    }
+    if (holds_other(owner)) {
+      ++_stats.overdrawn; // waiting could wait for itself
+      account(owner, bytes);
+      return true;
+    }
+    ++_stats.blocked;
+    _usage.try_emplace(owner, 0); // a waiting owner counts for fair sharing
+    ++_waiting[owner];
+    bool starving = usage(owner) + bytes <= fair_share(owner);
+    _starving += starving;
+    _released.wait(lock, [&] { return grantable(owner, bytes); });
+    _starving -= starving;
+    if (!--_waiting[owner]) {
+      _waiting.erase(owner);
+    }
+    account(owner, bytes);
+    return true;
+  }
+
+  void unaccount(const void *owner, std::size_t bytes) {
+    auto it = _usage.find(owner);
+    if (it != _usage.end()) {
+      bytes = std::min(bytes, it->second);
+      it->second -= bytes;
+      if (!it->second && !_waiting.count(owner)) {
+        _usage.erase(it);
+        _threads.erase(owner);
+      }
+      _stats.in_use -= bytes;
+    }
+    _released.notify_all();
+  }
+
+  void trim_pool() {
+    for (auto size = _pool.size(); size-- > 0 && _stats.pooled > _max_pooled;) {
+      auto &buffers = _pool[size];
+      while (!buffers.empty() && _stats.pooled > _max_pooled) {
+        delete[] buffers.back();
+        buffers.pop_back();
+        _stats.pooled -= std::size_t(1) << size;
+      }
+    }
+  }
+
+public:
+  s3buffer_governor() = default;
+  s3buffer_governor(const s3buffer_governor &) = delete;
+  s3buffer_governor &operator=(const s3buffer_governor &) = delete;
+
+  ~s3buffer_governor() {
+    for (auto &buffers : _pool) {
+      for (auto buffer : buffers) {
+        delete[] buffer;
+      }
+    }
+  }
+
+  /**
+   * The governor shared by all s3 streams of the process.
+   * @return
+   */
+  static s3buffer_governor &instance() {
+    static auto governor = new s3buffer_governor(); // never destroyed, streams may outlive static destruction
+    return *governor;
+  }
+
+  /**
+   * Sets the maximum number of bytes accounted to all owners together. Unlimited by default.
+   * @param bytes
+   */
+  void set_ceiling(std::size_t bytes) {
+    std::lock_guard lock(_mutex);
+    _ceiling = bytes;
+    _released.notify_all();
+  }
+
+  std::size_t ceiling() {
+    std::lock_guard lock(_mutex);
+    return _ceiling;
+  }
+
+  /**
+   * Sets how many bytes of released buffers are kept for recycling.
+   * @param bytes
+   */
+  void set_max_pooled(std::size_t bytes) {
+    std::lock_guard lock(_mutex);
+    _max_pooled = bytes;
+    trim_pool();
+  }
+
+  /**
+   * Accounts bytes to owner if the ceiling and fair sharing allow it, otherwise blocks or fails as
+   * requested by policy. Returns whether the bytes were accounted. A blocking request from a thread
+   * holding memory of other owners is granted past the ceiling instead, as that memory would never be
+   * released while it waits.
+   * @param owner
+   * @param bytes
+   * @param policy
+   * @return
+   */
+  bool reserve(const void *owner, std::size_t bytes, s3exhaustion policy = s3exhaustion::block) {
+    std::unique_lock lock(_mutex);
+    return reserve(lock, owner, bytes, policy);
+  }
+
+  /**
+   * Accounts bytes the owner already holds, regardless of the ceiling.
+   * Owners use it for memory they cannot size up front and then check exhausted.
+   * @param owner
+   * @param bytes
+   */
+  void commit(const void *owner, std::size_t bytes) {
+    std::lock_guard lock(_mutex);
+    account(owner, bytes);
+  }
+
+  /**
+   * Returns bytes accounted to owner.
+   * @param owner
+   * @param bytes
+   */
+  void release(const void *owner, std::size_t bytes) {
+    std::lock_guard lock(_mutex);
+    unaccount(owner, bytes);
+  }
+
+  /**
+   * Whether owner should give memory back: it is above its fair share while the ceiling is exceeded
+   * or while others wait for their share.
+   * @param owner
+   * @return
+   */
+  bool exhausted(const void *owner) {
+    std::lock_guard lock(_mutex);
+    return usage(owner) > fair_share(owner) && (_stats.in_use > _ceiling || _starving);
+  }
+
+  /**
+   * Returns a buffer of at least bytes accounted to owner, recycled from the pool when possible.
+   * Returns nullptr when the policy is degrade and the memory is not available.
+   * @param owner
+   * @param bytes
+   * @param policy
+   * @return
+   */
+  char *allocate(const void *owner, std::size_t bytes, s3exhaustion policy = s3exhaustion::block) {
+    auto size = size_class(bytes);
+    std::unique_lock lock(_mutex);
+    if (!reserve(lock, owner, std::size_t(1) << size, policy)) {
+      return nullptr;
+    }
+    if (_pool.size() > size && !_pool[size].empty()) {
+      auto buffer = _pool[size].back();
+      _pool[size].pop_back();
+      _stats.pooled -= std::size_t(1) << size;
+      ++_stats.recycled;
+      return buffer;
+    }
+    ++_stats.allocations;
+    lock.unlock();
+    return new char[std::size_t(1) << size]();
+  }
+
+  /**
+   * Returns a buffer obtained from allocate with the same owner and bytes.
+   * @param owner
+   * @param buffer
+   * @param bytes
+   */
+  void deallocate(const void *owner, char *buffer, std::size_t bytes) {
+    auto size = size_class(bytes);
+    std::lock_guard lock(_mutex);
+    unaccount(owner, std::size_t(1) << size);
+    if (_pool.size() <= size) {
+      _pool.resize(size + 1);
+    }
+    _pool[size].push_back(buffer);
+    _stats.pooled += std::size_t(1) << size;
+    trim_pool();
+  }
+
+  statistics stats() {
+    std::lock_guard lock(_mutex);
+    return _stats;
+  }
+};
+}
+
+#endif //S3STREAM_INCLUDE_S3BUFFER_GOVERNOR_H
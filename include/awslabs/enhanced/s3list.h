@@ -0,0 +1,389 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef S3STREAM_INCLUDE_S3LIST_H
+#define S3STREAM_INCLUDE_S3LIST_H
+
+#include <aws/core/client/ClientConfiguration.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
+#include <awslabs/enhanced/detail/aws_string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+/**
+ * Lightweight description of an object found while listing a prefix.
+ * key and etag view into the page that holds the entry, they remain valid until the iterator
+ * that produced the entry moves to the next page.
+ */
+struct s3object_entry {
+  std::string_view key;
+  std::string_view etag;
+  long long size = 0;
+};
+
+/**
+ * Options controlling how a prefix is listed.
+ */
+struct s3list_options {
+  /**
+   * Number of keys requested per ListObjectsV2 page (S3 caps it at 1000).
+   */
+  int max_keys = 1000;
+  /**
+   * Number of pages each partition fetches ahead of the consumer.
+   */
+  std::size_t prefetch_pages = 2;
+  /**
+   * Number of partitions listed concurrently.
+   */
+  std::size_t max_parallel = 8;
+  /**
+   * Split points of the keyspace. Partition i lists keys in (boundaries[i-1], boundaries[i]],
+   * the first partition is open at the start and the last one at the end.
+   * Boundaries are sorted before use.
+   */
+  std::vector<std::string> boundaries;
+  /**
+   * When not empty, the prefix is first listed with this delimiter and the common prefixes found
+   * are appended to boundaries, giving one partition per "directory".
+   */
+  std::string split_delimiter;
+};
+
+namespace Detail {
+/**
+ * A listed page together with the number of its objects that belong to the partition.
+ */
+struct list_page_t {
+  Aws::S3::Model::ListObjectsV2Result result;
+  std::size_t count = 0;
+};
+
+/**
+ * Lists one key range of a prefix in a background thread, keeping at most prefetch_pages pages ahead.
+ */
+class list_partition {
+  std::shared_ptr<Aws::S3::S3Client> _client;
+  Aws::S3::Model::ListObjectsV2Request _request;
+  std::string _last_key; // inclusive end of the range, empty for unbounded
+  std::size_t _depth;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<std::shared_ptr<list_page_t>> _pages;
+  std::string _error;
+  bool _done = false;
+  bool _stop = false;
+  std::thread _worker;
+
+  void push(std::shared_ptr<list_page_t> page) {
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [&] { return _stop || _pages.size() < _depth; });
+    if (!_stop) {
+      _pages.push_back(std::move(page));
+    }
+    _cv.notify_all();
+  }
+
+  void finish(std::string error = {}) {
+    std::lock_guard lock(_mutex);
+    _error = std::move(error);
+    _done = true;
+    _cv.notify_all();
+  }
+
+  bool stopping() {
+    std::lock_guard lock(_mutex);
+    return _stop;
+  }
+
+  void run() {
+    bool more = true;
+    while (more && !stopping()) {
+      auto outcome = _client->ListObjectsV2(_request);
+      if (!outcome.IsSuccess()) {
+        finish(std::string(outcome.GetError().GetMessage().c_str()));
+        return;
+      }
+      auto page = std::make_shared<list_page_t>();
+      page->result = outcome.GetResultWithOwnership();
+      const auto &contents = page->result.GetContents();
+      page->count = contents.size();
+      more = page->result.GetIsTruncated();
+      if (!_last_key.empty()) {
+        auto past_end = std::find_if(contents.begin(), contents.end(), [&](const auto &object) {
+          return std::string_view(object.GetKey().data(), object.GetKey().size()) > _last_key;
+        });
+        if (past_end != contents.end()) {
+          page->count = past_end - contents.begin();
+          more = false;
+        }
+      }
+      _request.SetContinuationToken(page->result.GetNextContinuationToken());
+      push(std::move(page));
+    }
+    finish();
+  }
+
+public:
+  list_partition(std::shared_ptr<Aws::S3::S3Client> client,
+                 const std::string &bucket,
+                 const std::string &prefix,
+                 const std::string &start_after,
+                 const std::string &last_key,
+                 const s3list_options &options)
+      : _client(std::move(client)), _last_key(last_key), _depth(std::max<std::size_t>(1, options.prefetch_pages)) {
+    _request.SetBucket(toAwsString(bucket));
+    _request.SetPrefix(toAwsString(prefix));
+    _request.SetMaxKeys(options.max_keys);
+    if (!start_after.empty()) {
+      _request.SetStartAfter(toAwsString(start_after));
+    }
+  }
+
+  list_partition(const list_partition &) = delete;
+  list_partition &operator=(const list_partition &) = delete;
+
+  ~list_partition() {
+    {
+      std::lock_guard lock(_mutex);
+      _stop = true;
+      _cv.notify_all();
+    }
+    if (_worker.joinable()) {
+      _worker.join();
+    }
+  }
+
+  /**
+   * Starts listing in the background, subsequent calls do nothing.
+   */
+  void start() {
+    if (!_worker.joinable()) {
+      _worker = std::thread([this] { run(); });
+    }
+  }
+
+  /**
+   * Blocks until the next page is available. Returns nullptr when the partition is exhausted
+   * and throws std::runtime_error when listing failed.
+   */
+  std::shared_ptr<list_page_t> next() {
+    start();
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [&] { return !_pages.empty() || _done; });
+    if (_pages.empty()) {
+      if (!_error.empty()) {
+        throw std::runtime_error(_error);
+      }
+      return nullptr;
+    }
+    auto page = std::move(_pages.front());
+    _pages.pop_front();
+    _cv.notify_all();
+    return page;
+  }
+};
+}
+
+/**
+ * Single pass range over the objects under an S3 prefix.
+ * Pages are fetched in background threads ahead of the consumer, and the keyspace can be split
+ * in partitions that are listed concurrently. Objects are produced in key order.
+ */
+class s3prefix_range {
+  std::shared_ptr<Aws::S3::S3Client> _client;
+  std::string _bucket;
+  std::string _prefix;
+  s3list_options _options;
+  std::vector<std::unique_ptr<Detail::list_partition>> _partitions;
+  std::size_t _current = 0;
+  std::shared_ptr<Detail::list_page_t> _page;
+  std::size_t _index = 0;
+  bool _started = false;
+
+  void split_on_delimiter() {
+    Aws::S3::Model::ListObjectsV2Request request;
+    request.SetBucket(Detail::toAwsString(_bucket));
+    request.SetPrefix(Detail::toAwsString(_prefix));
+    request.SetDelimiter(Detail::toAwsString(_options.split_delimiter));
+    bool more = true;
+    while (more) {
+      auto outcome = _client->ListObjectsV2(request);
+      if (!outcome.IsSuccess()) {
+        throw std::runtime_error(outcome.GetError().GetMessage().c_str());
+      }
+      const auto &result = outcome.GetResult();
+      for (const auto &common_prefix : result.GetCommonPrefixes()) {
+        _options.boundaries.emplace_back(common_prefix.GetPrefix().c_str(), common_prefix.GetPrefix().size());
+      }
+      more = result.GetIsTruncated();
+      request.SetContinuationToken(result.GetNextContinuationToken());
+    }
+  }
+
+  void make_partitions() {
+    if (!_options.split_delimiter.empty()) {
+      split_on_delimiter();
+    }
+    auto &boundaries = _options.boundaries;
+    std::sort(boundaries.begin(), boundaries.end());
+    boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+    std::string start_after;
+    for (const auto &boundary : boundaries) {
+      _partitions.push_back(std::make_unique<Detail::list_partition>(
+          _client, _bucket, _prefix, start_after, boundary, _options));
+      start_after = boundary;
+    }
+    _partitions.push_back(std::make_unique<Detail::list_partition>(
+        _client, _bucket, _prefix, start_after, std::string(), _options));
+  }
+
+  /**
+   * Keeps up to max_parallel partitions listing, starting at the one being consumed.
+   */
+  void start_partitions() {
+    auto last = std::min(_partitions.size(), _current + std::max<std::size_t>(1, _options.max_parallel));
+    for (auto i = _current; i < last; ++i) {
+      _partitions[i]->start();
+    }
+  }
+
+  /**
+   * Moves to the next non empty page, leaving _page null when everything was consumed.
+   */
+  void advance_page() {
+    _index = 0;
+    while (_current < _partitions.size()) {
+      start_partitions();
+      _page = _partitions[_current]->next();
+      if (!_page) {
+        _partitions[_current] = nullptr; // joins the finished worker
+        ++_current;
+      } else if (_page->count) {
+        return;
+      }
+    }
+    _page = nullptr;
+  }
+
+  void advance() {
+    if (_page && ++_index < _page->count) {
+      return;
+    }
+    advance_page();
+  }
+
+public:
+  class iterator {
+    s3prefix_range *_range = nullptr;
+    friend class s3prefix_range;
+    explicit iterator(s3prefix_range *range) : _range(range) {}
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = s3object_entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = s3object_entry;
+
+    iterator() = default;
+
+    s3object_entry operator*() const {
+      const auto &object = _range->_page->result.GetContents()[_range->_index];
+      return {std::string_view(object.GetKey().data(), object.GetKey().size()),
+              std::string_view(object.GetETag().data(), object.GetETag().size()),
+              object.GetSize()};
+    }
+
+    iterator &operator++() {
+      _range->advance();
+      if (!_range->_page) {
+        _range = nullptr;
+      }
+      return *this;
+    }
+
+    void operator++(int) {
+      ++*this;
+    }
+
+    friend bool operator==(const iterator &lhs, const iterator &rhs) {
+      return lhs._range == rhs._range;
+    }
+  };
+
+  /**
+   * Construct a range over the objects under prefix in bucket_name, using a new S3 client for region.
+   * @param region
+   * @param bucket_name
+   * @param prefix
+   * @param options
+   */
+  s3prefix_range(const std::string &region,
+                 const std::string &bucket_name,
+                 const std::string &prefix,
+                 s3list_options options = {})
+      : _bucket(bucket_name), _prefix(prefix), _options(std::move(options)) {
+    Aws::Client::ClientConfiguration config;
+    config.region = region;
+    _client = std::make_shared<Aws::S3::S3Client>(config);
+  }
+
+  /**
+   * Construct a range over the objects under prefix in bucket_name using an existing client.
+   * @param client
+   * @param bucket_name
+   * @param prefix
+   * @param options
+   */
+  s3prefix_range(std::shared_ptr<Aws::S3::S3Client> client,
+                 const std::string &bucket_name,
+                 const std::string &prefix,
+                 s3list_options options = {})
+      : _client(std::move(client)), _bucket(bucket_name), _prefix(prefix), _options(std::move(options)) {}
+
+  s3prefix_range(const s3prefix_range &) = delete;
+  s3prefix_range &operator=(const s3prefix_range &) = delete;
+
+  /**
+   * Starts listing and returns an iterator to the first object. The range is single pass,
+   * calling begin again continues from the current position.
+   * Listing failures are reported by throwing std::runtime_error.
+   * @return
+   */
+  iterator begin() {
+    if (!_started) {
+      _started = true;
+      make_partitions();
+      advance_page();
+    }
+    return _page ? iterator(this) : iterator();
+  }
+
+  iterator end() {
+    return iterator();
+  }
+
+  /**
+   * Returns the number of partitions the keyspace was split into, valid after begin().
+   * @return
+   */
+  std::size_t partitions() const {
+    return _partitions.size();
+  }
+};
+}
+
+#endif //S3STREAM_INCLUDE_S3LIST_H
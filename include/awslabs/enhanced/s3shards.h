@@ -0,0 +1,415 @@
+// Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef S3STREAM_INCLUDE_S3SHARDS_H
+#define S3STREAM_INCLUDE_S3SHARDS_H
+
+#include <aws/core/client/ClientConfiguration.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
+#include <awslabs/enhanced/executor.h>
+#include <awslabs/enhanced/s3buffer_governor.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+/**
+ * Options for s3shard_writer.
+ */
+struct s3shard_options {
+  /**
+   * A shard is uploaded as a multipart part once it buffers this many bytes.
+   * S3 requires every part but the last one to be at least 5 MiB.
+   */
+  std::size_t part_size = 8 * 1024 * 1024;
+  /**
+   * Ceiling for the bytes buffered or being uploaded across all shards of the writer.
+   * The bytes are also accounted to the process wide s3buffer_governor, whose ceiling applies as well.
+   */
+  std::size_t memory_budget = 256 * 1024 * 1024;
+  /**
+   * Maximum number of concurrent uploads of the writer. Uploads run on the shared executor.
+   */
+  std::size_t upload_threads = 16;
+};
+
+namespace Detail {
+constexpr std::size_t min_part_size = 5 * 1024 * 1024;
+// S3 rejects parts numbered above this in a multipart upload
+constexpr std::size_t max_parts = 10000;
+
+/**
+ * streambuf appending everything written to a target string.
+ */
+class string_appendbuf : public std::streambuf {
+  std::string *_target = nullptr;
+public:
+  void target(std::string *target) {
+    _target = target;
+  }
+protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    _target->append(s, n);
+    return n;
+  }
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      _target->push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+  }
+};
+}
+
+/**
+ * Writes records to many S3 objects, routing every record to a shard with a user key function.
+ * All shards share one S3 client, one upload thread pool and one memory budget. A shard is uploaded
+ * as a multipart part whenever it fills, and when the budget or the s3buffer_governor is exhausted the
+ * largest shards are flushed early. If memory is still short with nothing left in flight, the largest shard is completed
+ * and continues in a new object segment, so a shard may span objects name(shard, 0), name(shard, 1)...
+ * A shard also continues in a new segment once its upload has the most parts S3 accepts.
+ *
+ * Records are written with operator<<. write is meant to be called from a single producer thread.
+ * @tparam Record
+ */
+template<typename Record>
+class s3shard_writer {
+public:
+  using key_function = std::function<std::size_t(const Record &)>;
+  using name_function = std::function<std::string(std::size_t shard, std::size_t segment)>;
+
+private:
+  struct shard {
+    std::string buffer;
+    std::size_t segment = 0;
+    Aws::String upload_id;
+    std::vector<Aws::S3::Model::CompletedPart> parts;
+    std::size_t pending = 0; // uploads in flight
+    bool written = false;    // something was written to the current segment
+  };
+
+  std::shared_ptr<Aws::S3::S3Client> _client;
+  std::string _bucket;
+  name_function _name;
+  key_function _key;
+  s3shard_options _options;
+  std::vector<shard> _shards;
+  Detail::string_appendbuf _appendbuf;
+  std::ostream _out{&_appendbuf};
+
+  std::mutex _mutex;
+  std::condition_variable _released;
+  std::size_t _buffered = 0;  // bytes held by shard buffers
+  std::size_t _in_flight = 0; // bytes held by uploads
+  bool _failed = false;
+  bool _closed = false;
+
+  void upload_done(std::size_t bytes, bool success) {
+    s3buffer_governor::instance().release(this, bytes);
+    std::lock_guard lock(_mutex);
+    _in_flight -= bytes;
+    _failed = _failed || !success;
+    _released.notify_all();
+  }
+
+  /**
+   * Uploads the shard buffer as the next part of the shard's multipart upload. The last part S3 accepts
+   * completes the upload and the shard continues in a new segment.
+   */
+  void flush_part(shard &s) {
+    if (s.upload_id.empty()) {
+      Aws::S3::Model::CreateMultipartUploadRequest request;
+      request.SetBucket(_bucket);
+      request.SetKey(_name(&s - _shards.data(), s.segment));
+      auto outcome = _client->CreateMultipartUpload(request);
+      if (!outcome.IsSuccess()) {
+        // The writer has failed, drop the bytes rather than keep accounting them
+        auto bytes = s.buffer.size();
+        s.buffer = std::string();
+        s3buffer_governor::instance().release(this, bytes);
+        std::lock_guard lock(_mutex);
+        _buffered -= bytes;
+        _failed = true;
+        return;
+      }
+      s.upload_id = outcome.GetResult().GetUploadId();
+    }
+    auto bytes = s.buffer.size();
+    auto part_number = static_cast<int>(s.parts.size()) + 1;
+    Aws::S3::Model::UploadPartRequest request;
+    request.SetBucket(_bucket);
+    request.SetKey(_name(&s - _shards.data(), s.segment));
+    request.SetUploadId(s.upload_id);
+    request.SetPartNumber(part_number);
+    request.SetBody(std::make_shared<std::stringstream>(std::move(s.buffer)));
+    s.buffer = std::string();
+    {
+      std::lock_guard lock(_mutex);
+      s.parts.emplace_back();
+      s.parts.back().SetPartNumber(part_number);
+      _buffered -= bytes;
+      _in_flight += bytes;
+      ++s.pending;
+    }
+    _client->UploadPartAsync(request, [this, &s, bytes, part_number](
+        const Aws::S3::S3Client *,
+        const Aws::S3::Model::UploadPartRequest &,
+        Aws::S3::Model::UploadPartOutcome outcome,
+        const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+      {
+        std::lock_guard lock(_mutex);
+        if (outcome.IsSuccess()) {
+          s.parts[part_number - 1].SetETag(outcome.GetResult().GetETag());
+        }
+        --s.pending;
+      }
+      upload_done(bytes, outcome.IsSuccess());
+    });
+    if (static_cast<std::size_t>(part_number) == Detail::max_parts) {
+      complete(s);
+      ++s.segment;
+    }
+  }
+
+  /**
+   * Starts the upload of whatever the shard still buffers, as the final part or as a whole object.
+   */
+  void flush_last(shard &s) {
+    if (!s.upload_id.empty()) {
+      if (!s.buffer.empty()) {
+        flush_part(s);
+      }
+      return;
+    }
+    auto bytes = s.buffer.size();
+    Aws::S3::Model::PutObjectRequest request;
+    request.SetBucket(_bucket);
+    request.SetKey(_name(&s - _shards.data(), s.segment));
+    request.SetBody(std::make_shared<std::stringstream>(std::move(s.buffer)));
+    s.buffer = std::string();
+    {
+      std::lock_guard lock(_mutex);
+      _buffered -= bytes;
+      _in_flight += bytes;
+      ++s.pending;
+    }
+    _client->PutObjectAsync(request, [this, &s, bytes](
+        const Aws::S3::S3Client *,
+        const Aws::S3::Model::PutObjectRequest &,
+        Aws::S3::Model::PutObjectOutcome outcome,
+        const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+      {
+        std::lock_guard lock(_mutex);
+        --s.pending;
+      }
+      upload_done(bytes, outcome.IsSuccess());
+    });
+  }
+
+  /**
+   * Waits for the shard uploads and completes its multipart upload, if any.
+   */
+  void complete(shard &s) {
+    bool failed;
+    {
+      std::unique_lock lock(_mutex);
+      _released.wait(lock, [&] { return s.pending == 0; });
+      failed = _failed;
+    }
+    if (!s.upload_id.empty()) {
+      auto key = _name(&s - _shards.data(), s.segment);
+      if (failed) {
+        Aws::S3::Model::AbortMultipartUploadRequest request;
+        request.SetBucket(_bucket);
+        request.SetKey(key);
+        request.SetUploadId(s.upload_id);
+        _client->AbortMultipartUpload(request);
+      } else {
+        Aws::S3::Model::CompletedMultipartUpload upload;
+        upload.SetParts(s.parts);
+        Aws::S3::Model::CompleteMultipartUploadRequest request;
+        request.SetBucket(_bucket);
+        request.SetKey(key);
+        request.SetUploadId(s.upload_id);
+        request.SetMultipartUpload(upload);
+        auto outcome = _client->CompleteMultipartUpload(request);
+        std::lock_guard lock(_mutex);
+        _failed = _failed || !outcome.IsSuccess();
+      }
+    }
+    s.upload_id.clear();
+    s.parts.clear();
+    s.written = false;
+  }
+
+  bool over_budget() {
+    return _buffered + _in_flight > _options.memory_budget || s3buffer_governor::instance().exhausted(this);
+  }
+
+  /**
+   * Brings the memory in use back under the budget.
+   */
+  void enforce_budget() {
+    std::unique_lock lock(_mutex);
+    while (!_failed && over_budget()) {
+      auto largest = std::max_element(_shards.begin(), _shards.end(), [](const auto &a, const auto &b) {
+        return a.buffer.size() < b.buffer.size();
+      });
+      if (largest->buffer.size() >= Detail::min_part_size) {
+        lock.unlock();
+        flush_part(*largest);
+        lock.lock();
+      } else if (_in_flight) {
+        _released.wait(lock);
+      } else if (largest->buffer.empty()) {
+        break; // the governor is exhausted by other owners, nothing left to give back
+      } else {
+        lock.unlock();
+        flush_last(*largest);
+        // Unless its last part already moved the shard to a new segment
+        if (largest->written) {
+          complete(*largest);
+          ++largest->segment;
+        }
+        lock.lock();
+      }
+    }
+  }
+
+public:
+  /**
+   * Constructs a writer for shards objects in bucket_name, naming them with name.
+   * Throws std::invalid_argument when shards is 0.
+   * @param region
+   * @param bucket_name
+   * @param shards
+   * @param name
+   * @param key
+   * @param options
+   */
+  s3shard_writer(const std::string &region,
+                 const std::string &bucket_name,
+                 std::size_t shards,
+                 name_function name,
+                 key_function key,
+                 s3shard_options options = {})
+      : _bucket(bucket_name), _name(std::move(name)), _key(std::move(key)), _options(options), _shards(shards) {
+    if (shards == 0) {
+      throw std::invalid_argument("s3shard_writer needs at least one shard");
+    }
+    _options.part_size = std::max(_options.part_size, Detail::min_part_size);
+    Aws::Client::ClientConfiguration config;
+    config.region = region;
+    config.executor = shared_executor();
+    config.maxConnections = static_cast<unsigned>(_options.upload_threads);
+    _client = std::make_shared<Aws::S3::S3Client>(config);
+  }
+
+  /**
+   * Constructs a writer whose objects are named object_prefix followed by the shard number,
+   * and by .segment for segments after the first one.
+   * @param region
+   * @param bucket_name
+   * @param object_prefix
+   * @param shards
+   * @param key
+   * @param options
+   */
+  s3shard_writer(const std::string &region,
+                 const std::string &bucket_name,
+                 const std::string &object_prefix,
+                 std::size_t shards,
+                 key_function key,
+                 s3shard_options options = {})
+      : s3shard_writer(region, bucket_name, shards,
+                       [object_prefix](std::size_t shard, std::size_t segment) {
+                         auto name = object_prefix + std::to_string(shard);
+                         return segment ? name + "." + std::to_string(segment) : name;
+                       },
+                       std::move(key), options) {}
+
+  s3shard_writer(const s3shard_writer &) = delete;
+  s3shard_writer &operator=(const s3shard_writer &) = delete;
+
+  /**
+   * Closes the writer, completing every upload.
+   */
+  ~s3shard_writer() {
+    try {
+      close();
+    } catch (...) {
+      // Don't throw from destructors
+    }
+  }
+
+  /**
+   * Appends record to the shard selected by the key function.
+   * Blocks while the memory budget is exhausted and uploads are in flight.
+   * @param record
+   */
+  void write(const Record &record) {
+    auto &s = _shards[_key(record) % _shards.size()];
+    auto before = s.buffer.size();
+    _appendbuf.target(&s.buffer);
+    _out << record;
+    s.written = true;
+    s3buffer_governor::instance().commit(this, s.buffer.size() - before);
+    {
+      std::lock_guard lock(_mutex);
+      _buffered += s.buffer.size() - before;
+    }
+    if (s.buffer.size() >= _options.part_size) {
+      flush_part(s);
+    }
+    enforce_budget();
+  }
+
+  /**
+   * Number of shards records are routed to.
+   * @return
+   */
+  std::size_t shards() const {
+    return _shards.size();
+  }
+
+  /**
+   * Uploads what is still buffered and completes the objects of every shard that was written to.
+   * Returns false if any upload failed. Closing a closed writer fails.
+   * @return
+   */
+  bool close() {
+    if (_closed) {
+      return false;
+    }
+    _closed = true;
+    for (auto &s : _shards) {
+      if (s.written) {
+        flush_last(s);
+      }
+    }
+    for (auto &s : _shards) {
+      complete(s);
+    }
+    std::lock_guard lock(_mutex);
+    return !_failed;
+  }
+};
+}
+
+#endif //S3STREAM_INCLUDE_S3SHARDS_H
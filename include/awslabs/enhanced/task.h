@@ -0,0 +1,241 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AwsLabs::Enhanced {
+
+template<typename T = void>
+class task;
+
+namespace Detail {
+template<typename T>
+struct task_promise_base {
+  std::coroutine_handle<> continuation;
+  std::exception_ptr error;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  // Resumes the awaiting coroutine without growing the stack
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+      auto continuation = h.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  final_awaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct task_promise : task_promise_base<T> {
+  std::optional<T> value;
+
+  task<T> get_return_object();
+
+  void return_value(T v) { value = std::move(v); }
+
+  T result() {
+    if (this->error)
+      std::rethrow_exception(this->error);
+    return std::move(*value);
+  }
+};
+
+template<>
+struct task_promise<void> : task_promise_base<void> {
+  task<void> get_return_object();
+
+  void return_void() {}
+
+  void result() {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+}
+
+/**
+ * Coroutine producing a T, started when awaited. It runs on the thread resuming it, e.g. the executor thread
+ * completing a Lambda invocation it awaits, so it should not block.
+ */
+template<typename T>
+class task {
+public:
+  using promise_type = Detail::task_promise<T>;
+
+  explicit task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (handle)
+        handle.destroy();
+      handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  auto operator co_await() noexcept {
+    struct awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+      }
+
+      T await_resume() { return handle.promise().result(); }
+    };
+    return awaiter{handle};
+  }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace Detail {
+template<typename T>
+task<T> task_promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+  return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+/**
+ * Coroutine started immediately and destroying itself when done.
+ */
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+/**
+ * Counts the tasks of when_all still running, plus the awaiting coroutine, which the last one to finish resumes.
+ */
+struct when_all_state {
+  std::atomic<std::size_t> remaining;
+  std::coroutine_handle<> continuation;
+  std::mutex mutex;
+  std::exception_ptr error;
+
+  explicit when_all_state(std::size_t tasks) : remaining(tasks + 1) {}
+
+  void arrive() {
+    if (--remaining == 0)
+      continuation.resume();
+  }
+
+  bool await_ready() noexcept { return false; }
+
+  bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+    continuation = awaiting;
+    return --remaining != 0;
+  }
+
+  void await_resume() {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+
+template<typename T>
+detached_task run_when_all_task(task<T> &t, std::optional<T> &slot, when_all_state &state) {
+  try {
+    slot.emplace(co_await t);
+  } catch (...) {
+    std::lock_guard lock(state.mutex);
+    if (!state.error)
+      state.error = std::current_exception();
+  }
+  state.arrive();
+}
+}
+
+/**
+ * Runs all the tasks concurrently and returns their results in order, or rethrows the first exception
+ * once all are done.
+ * @param tasks
+ * @return
+ */
+template<typename T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+  Detail::when_all_state state(tasks.size());
+  std::vector<std::optional<T>> slots(tasks.size());
+  for (std::size_t i = 0; i < tasks.size(); ++i)
+    Detail::run_when_all_task(tasks[i], slots[i], state);
+  co_await state;
+  std::vector<T> values;
+  values.reserve(slots.size());
+  for (auto &slot : slots)
+    values.push_back(std::move(*slot));
+  co_return values;
+}
+
+/**
+ * Blocks the calling thread until t is done, for starting coroutines from ordinary code.
+ * @param t
+ * @return
+ */
+template<typename T>
+T sync_wait(task<T> t) {
+  std::exception_ptr error;
+  std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+  // The promise is moved into the coroutine frame, so it is not destroyed here while setting its value
+  auto run = [&](std::promise<void> done) -> Detail::detached_task {
+    try {
+      if constexpr (std::is_void_v<T>) {
+        co_await t;
+        value.emplace(true);
+      } else {
+        value.emplace(co_await t);
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+    done.set_value();
+  };
+  std::promise<void> done;
+  auto finished = done.get_future();
+  run(std::move(done));
+  finished.get();
+  if (error)
+    std::rethrow_exception(error);
+  if constexpr (!std::is_void_v<T>)
+    return std::move(*value);
+}
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/lambda_admission.h"
+
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+using AwsLabs::Enhanced::AdmissionController;
+using AwsLabs::Enhanced::AdmissionOptions;
+
+TEST(admissionTest, CallsBeyondTheLimitAreQueued) {
+  AdmissionController admission(AdmissionOptions(), 4);
+  std::atomic<std::size_t> running = 0, peak = 0, done = 0;
+  std::promise<void> finished;
+  std::vector<std::thread> calls;
+  std::mutex mutex;
+  for (int i = 0; i < 20; ++i) {
+    admission.submit([&](std::size_t ticket) {
+      auto now = ++running;
+      std::size_t seen = peak;
+      while (now > seen && !peak.compare_exchange_weak(seen, now)) {}
+      std::lock_guard lock(mutex);
+      calls.emplace_back([&, ticket] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        --running;
+        admission.finish(ticket, false);
+        if (++done == 20)
+          finished.set_value();
+      });
+    });
+  }
+  finished.get_future().get();
+  {
+    std::lock_guard lock(mutex);
+    for (auto &call : calls)
+      call.join();
+  }
+  EXPECT_EQ(peak, 4u);
+  EXPECT_EQ(admission.stats().queued, 0u);
+}
+
+TEST(admissionTest, ThrottlesLowerTheLimitOncePerWindow) {
+  AdmissionOptions options;
+  options.decrease = 0.5;
+  AdmissionController admission(options, 8);
+  std::vector<std::size_t> tickets;
+  std::mutex mutex;
+  std::promise<void> started;
+  for (int i = 0; i < 8; ++i) {
+    admission.submit([&](std::size_t ticket) {
+      std::lock_guard lock(mutex);
+      tickets.push_back(ticket);
+      if (tickets.size() == 8)
+        started.set_value();
+    });
+  }
+  started.get_future().get();
+  for (auto ticket : tickets)
+    admission.finish(ticket, true);
+  auto stats = admission.stats();
+  EXPECT_DOUBLE_EQ(stats.limit, 4);
+  EXPECT_EQ(stats.throttled, 8u);
+  EXPECT_EQ(stats.inFlight, 0u);
+  // Successes grow it back by one per limit calls
+  for (int i = 0; i < 4; ++i) {
+    std::promise<std::size_t> ticket;
+    admission.submit([&](std::size_t t) { ticket.set_value(t); });
+    admission.finish(ticket.get_future().get(), false);
+  }
+  EXPECT_NEAR(admission.stats().limit, 5, 0.1);
+}
+
+TEST(admissionTest, TheRateIsLimited) {
+  AdmissionOptions options;
+  options.rate = 100;
+  options.burst = 1;
+  AdmissionController admission(options, 100);
+  std::atomic<int> starts = 0;
+  std::promise<void> finished;
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < 11; ++i) {
+    admission.submit([&](std::size_t ticket) {
+      admission.finish(ticket, false);
+      if (++starts == 11)
+        finished.set_value();
+    });
+  }
+  finished.get_future().get();
+  EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(95));
+}
+
+TEST(admissionTest, BackoffIsJitteredUnderTheCap) {
+  AdmissionOptions options;
+  options.baseBackoff = std::chrono::milliseconds(10);
+  options.maxBackoff = std::chrono::milliseconds(100);
+  AdmissionController admission(options, 1);
+  for (std::size_t retry = 0; retry < 12; ++retry) {
+    auto delay = admission.backoff(retry);
+    EXPECT_LE(delay, std::min(std::chrono::milliseconds(10 << std::min<std::size_t>(retry, 4)),
+                              std::chrono::milliseconds(100)));
+  }
+}
+
+TEST(admissionTest, QueuedCallsAreCancelledOnDestruction) {
+  std::vector<std::size_t> tickets;
+  std::mutex mutex;
+  {
+    AdmissionController admission(AdmissionOptions(), 1);
+    std::promise<void> started;
+    admission.submit([&](std::size_t ticket) {
+      std::lock_guard lock(mutex);
+      tickets.push_back(ticket);
+      started.set_value();
+    });
+    started.get_future().get();
+    admission.submit([&](std::size_t ticket) {
+      std::lock_guard lock(mutex);
+      tickets.push_back(ticket);
+    });
+    admission.submit([&](std::size_t ticket) {
+      std::lock_guard lock(mutex);
+      tickets.push_back(ticket);
+    }, AdmissionController::Clock::now() + std::chrono::hours(1));
+  }
+  ASSERT_EQ(tickets.size(), 3u);
+  EXPECT_NE(tickets[0], AdmissionController::cancelled);
+  EXPECT_EQ(tickets[1], AdmissionController::cancelled);
+  EXPECT_EQ(tickets[2], AdmissionController::cancelled);
+}
+}
@@ -0,0 +1,89 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/async_log_system.h"
+
+#include "gtest/gtest.h"
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+using AwsLabs::Enhanced::async_log_options;
+using AwsLabs::Enhanced::async_log_system;
+using Aws::Utils::Logging::LogLevel;
+
+std::size_t count_lines(const std::string &text, const std::string &needle = "\n") {
+  std::size_t count = 0;
+  for (auto pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + needle.size())) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(asyncLogSystemTest, MessagesOfAllThreadsAreWrittenOnFlush) {
+  auto output = std::make_shared<std::stringstream>();
+  async_log_system log(LogLevel::Trace, output, async_log_options{1024 * 1024, std::chrono::hours(1)});
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 1000; ++i) {
+        log.Log(LogLevel::Debug, "test", "thread %d message %d", t, i);
+      }
+      Aws::OStringStream stream;
+      stream << "streamed by " << t;
+      log.LogStream(LogLevel::Info, "test", stream);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  log.Flush();
+  auto text = output->str();
+  ASSERT_EQ(log.dropped(), 0);
+  ASSERT_EQ(count_lines(text), 4004);
+  ASSERT_NE(text.find("[DEBUG] "), std::string::npos);
+  ASSERT_NE(text.find(" test ["), std::string::npos);
+  ASSERT_NE(text.find("] thread 3 message 999\n"), std::string::npos);
+  ASSERT_EQ(count_lines(text, "[INFO] "), 4);
+}
+
+TEST(asyncLogSystemTest, FullRingsDropAndCountMessages) {
+  auto output = std::make_shared<std::stringstream>();
+  async_log_system log(LogLevel::Trace, output, async_log_options{4096, std::chrono::hours(1)});
+  std::string payload(100, 'x');
+  for (int i = 0; i < 1000; ++i) {
+    log.Log(LogLevel::Trace, "test", "%s", payload.c_str());
+  }
+  log.Flush();
+  ASSERT_GT(log.dropped(), 0) << "A 4KiB ring cannot hold 1000 messages";
+  ASSERT_EQ(count_lines(output->str()) + log.dropped(), 1000);
+}
+
+TEST(asyncLogSystemTest, FormatsAreFormattedOnTheWriterThread) {
+  auto output = std::make_shared<std::stringstream>();
+  async_log_system log(LogLevel::Trace, output, async_log_options{1024 * 1024, std::chrono::hours(1)});
+  char name[] = "object";
+  log.Log(LogLevel::Info, "test", "%s %5d|%-4u|%lld|%zu|%x|%c|%.2f|%*.*s|%Lg|%%|%hhd",
+          name, 42, 7u, -3ll, std::size_t(9), 255u, 'z', 3.14159, 6, 3, "abcdef", 2.5L, 300);
+  name[0] = 'X'; // strings are copied when logged
+  log.Log(LogLevel::Info, "test", "%2$s %1$s", "b", "a"); // positional arguments are formatted when logged
+  log.Flush();
+  auto text = output->str();
+  ASSERT_NE(text.find("] object    42|7   |-3|9|ff|z|3.14|   abc|2.5|%|44\n"), std::string::npos) << text;
+  ASSERT_NE(text.find("] a b\n"), std::string::npos) << text;
+}
+
+TEST(asyncLogSystemTest, LongMessagesAreFormattedCompletely) {
+  auto output = std::make_shared<std::stringstream>();
+  {
+    async_log_system log(LogLevel::Trace, output);
+    std::string payload(2000, 'y');
+    log.Log(LogLevel::Error, "test", "%s", payload.c_str());
+  } // destruction writes the pending messages
+  ASSERT_NE(output->str().find(std::string(2000, 'y') + "\n"), std::string::npos);
+}
+}
@@ -0,0 +1,74 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/lambda_broadcast.h"
+
+#include "gtest/gtest.h"
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+using AwsLabs::Enhanced::Detail::BroadcastCache;
+
+// Fetches value as if it had size serialized bytes, counting the fetches
+auto fetching(int value, std::size_t size, int &fetches) {
+  return [=, &fetches] {
+    ++fetches;
+    return std::pair(std::make_shared<int const>(value), size);
+  };
+}
+
+TEST(broadcastCacheTest, ValuesAreFetchedOnce) {
+  BroadcastCache cache;
+  int fetches = 0;
+  auto first = cache.get<int>("a", fetching(1, 10, fetches));
+  auto second = cache.get<int>("a", fetching(2, 10, fetches));
+  ASSERT_EQ(fetches, 1);
+  ASSERT_EQ(first, second);
+  ASSERT_EQ(*second, 1);
+}
+
+TEST(broadcastCacheTest, LeastRecentlyUsedValuesAreEvicted) {
+  BroadcastCache cache;
+  cache.setCapacity(25);
+  int fetches = 0;
+  auto a = cache.get<int>("a", fetching(1, 10, fetches));
+  cache.get<int>("b", fetching(2, 10, fetches));
+  cache.get<int>("a", fetching(1, 10, fetches)); // b is now the least recently used
+  cache.get<int>("c", fetching(3, 10, fetches));
+  ASSERT_EQ(fetches, 3);
+  cache.get<int>("a", fetching(1, 10, fetches));
+  ASSERT_EQ(fetches, 3);
+  cache.get<int>("b", fetching(2, 10, fetches));
+  ASSERT_EQ(fetches, 4) << "b should have been evicted";
+  // Evicted values live on while held
+  cache.setCapacity(0);
+  ASSERT_EQ(*a, 1);
+  cache.get<int>("a", fetching(1, 10, fetches));
+  ASSERT_EQ(fetches, 5);
+}
+
+TEST(broadcastCacheTest, FailedFetchesAreRetried) {
+  BroadcastCache cache;
+  int fetches = 0;
+  ASSERT_THROW(cache.get<int>("a", []() -> std::pair<std::shared_ptr<int const>, std::size_t> {
+    throw std::runtime_error("unavailable");
+  }), std::runtime_error);
+  ASSERT_EQ(*cache.get<int>("a", fetching(1, 10, fetches)), 1);
+  ASSERT_EQ(fetches, 1);
+}
+
+TEST(broadcastCacheTest, PutValuesAreAccounted) {
+  BroadcastCache cache;
+  cache.setCapacity(15);
+  int fetches = 0;
+  cache.put<int>("a", std::make_shared<int const>(1), 10);
+  ASSERT_EQ(*cache.get<int>("a", fetching(2, 10, fetches)), 1);
+  cache.get<int>("b", fetching(2, 10, fetches));
+  cache.get<int>("a", fetching(3, 10, fetches));
+  ASSERT_EQ(fetches, 2) << "a should have been evicted";
+}
+}
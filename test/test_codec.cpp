@@ -0,0 +1,123 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/detail/lambda_detail.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+using namespace AwsLabs::Enhanced::Detail;
+
+std::string encoded(std::string const &bytes) {
+  Aws::String out;
+  base64Encode(reinterpret_cast<uint8_t const *>(bytes.data()), bytes.size(), out);
+  return std::string(out.begin(), out.end());
+}
+
+std::string decoded(std::string const &base64) {
+  std::vector<uint8_t> out;
+  base64Decode(base64, out);
+  return std::string(out.begin(), out.end());
+}
+
+TEST(codecTest, Base64MatchesTheStandardVectors) {
+  std::vector<std::pair<std::string, std::string>> vectors{
+      {"", ""}, {"f", "Zg=="}, {"fo", "Zm8="}, {"foo", "Zm9v"},
+      {"foob", "Zm9vYg=="}, {"fooba", "Zm9vYmE="}, {"foobar", "Zm9vYmFy"}};
+  for (auto const &[bytes, base64] : vectors) {
+    ASSERT_EQ(encoded(bytes), base64);
+    ASSERT_EQ(decoded(base64), bytes);
+  }
+}
+
+TEST(codecTest, Base64RoundTrips) {
+  std::mt19937 random(42);
+  for (std::size_t size = 0; size < 200; ++size) {
+    std::string bytes(size, '\0');
+    for (auto &b : bytes) {
+      b = static_cast<char>(random());
+    }
+    ASSERT_EQ(decoded(encoded(bytes)), bytes);
+  }
+}
+
+TEST(codecTest, InvalidBase64Throws) {
+  ASSERT_THROW(decoded("Zm9"), std::runtime_error);
+  ASSERT_THROW(decoded("Zm9*"), std::runtime_error);
+  ASSERT_THROW(decoded("Z==="), std::runtime_error);
+}
+
+struct parameters {
+  double lambda;
+  unsigned samples;
+};
+
+TEST(codecTest, FlatTypesRoundTripWithoutAlpaca) {
+  static_assert(FlatLayout<ArgsHolder<int, int, parameters>>::flat);
+  static_assert(!FlatLayout<ArgsHolder<int, int, std::vector<int>>>::flat);
+  static_assert(!FlatLayout<ResultHolder<char const *>>::flat);
+  auto args = decode<ArgsHolder<int, int, parameters>>(encode(ArgsHolder(std::tuple(0, 0, parameters{0.5, 7u})), true));
+  ASSERT_EQ(std::get<2>(args.tup).lambda, 0.5);
+  ASSERT_EQ(std::get<2>(args.tup).samples, 7u);
+  ASSERT_EQ(decode<ResultHolder<double>>(encode(ResultHolder<double>(2.5), true)).result, 2.5);
+}
+
+TEST(codecTest, FlatTypesUseAlpacaUnlessAskedFor) {
+  ResultHolder<double> holder(2.5);
+  auto &bytes = serialize(holder);
+  std::vector<uint8_t> alpacaBytes(bytes.begin(), bytes.end());
+  releaseCodecBuffer(bytes);
+  ASSERT_FALSE(isFlatEncoding<ResultHolder<double>>(alpacaBytes));
+  ASSERT_EQ(decode<ResultHolder<double>>(encode(holder)).result, 2.5);
+}
+
+struct intThenFloat {
+  int i;
+  float f;
+};
+
+struct floatThenInt {
+  float f;
+  int i;
+};
+
+TEST(codecTest, MismatchedFlatTypesThrow) {
+  auto encoded = encode(ArgsHolder(std::tuple(0, 0, 1.0)), true);
+  ASSERT_THROW((decode<ArgsHolder<int, int, float, float>>(encoded)), std::runtime_error);
+  ASSERT_THROW((decode<ArgsHolder<int, int, long>>(encoded)), std::runtime_error);
+  auto reordered = encode(ArgsHolder(std::tuple(0, 0, intThenFloat{1, 2.0f})), true);
+  ASSERT_THROW((decode<ArgsHolder<int, int, floatThenInt>>(reordered)), std::runtime_error);
+}
+
+TEST(codecTest, FunctionIdsDependOnNameAndSignature) {
+  constexpr auto add = functionId<int(int, int)>("add");
+  static_assert(add == functionId<int(int const &, int)>("add"));
+  static_assert(add != functionId<int(int, int)>("sub"));
+  static_assert(add != functionId<long(int, int)>("add"));
+  static_assert(add != functionId<int(int, int, int)>("add"));
+  static_assert(functionId<int(float)>("f") != functionId<int(std::vector<int>)>("f"));
+  static_assert(functionId<int(std::string)>("f") != functionId<int(std::vector<int>)>("f"));
+  static_assert(functionId<int(intThenFloat)>("f") != functionId<int(floatThenInt)>("f"));
+  ASSERT_EQ(add, functionId<int(int, int)>(std::string("add")));
+}
+
+TEST(codecTest, FieldsAreFoundInCompactAndReadableJson) {
+  std::ostringstream compact;
+  writeCompactJson(compact, "value", "Zm9v");
+  ASSERT_EQ(compact.str(), R"({"value":"Zm9v"})");
+  ASSERT_EQ(*stringField(compact.str(), "value"), "Zm9v");
+  std::string readable = "{\n\t\"values\":\t\"Zm9vYmFy\",\n\t\"compute_us\":\t1234\n}";
+  ASSERT_EQ(*stringField(readable, "values"), "Zm9vYmFy");
+  ASSERT_EQ(*int64Field(readable, "compute_us"), 1234);
+  ASSERT_FALSE(stringField(readable, "value"));
+  ASSERT_FALSE(stringField(R"({"transform_reduce":"Zm9v"})", "reduce"));
+  ASSERT_FALSE(stringField(R"({"value":"a\"b"})", "value"));
+}
+}
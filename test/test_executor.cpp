@@ -0,0 +1,73 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/executor.h"
+
+#include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace {
+using AwsLabs::Enhanced::executor_options;
+using AwsLabs::Enhanced::work_stealing_executor;
+
+TEST(workStealingExecutorTest, RunsEverySubmittedTask) {
+  std::atomic<int> count = 0;
+  {
+    work_stealing_executor executor(executor_options{4});
+    for (int i = 0; i < 10000; ++i) {
+      ASSERT_TRUE(executor.Submit([&] { ++count; }));
+    }
+  } // the destructor runs the queued tasks
+  ASSERT_EQ(count, 10000);
+}
+
+TEST(workStealingExecutorTest, ThreadCountIsBounded) {
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::latch done(1000);
+  work_stealing_executor executor(executor_options{3});
+  for (int i = 0; i < 1000; ++i) {
+    executor.Submit([&] {
+      {
+        std::lock_guard lock(mutex);
+        threads.insert(std::this_thread::get_id());
+      }
+      done.count_down();
+    });
+  }
+  done.wait();
+  ASSERT_EQ(executor.threads(), 3);
+  ASSERT_LE(threads.size(), 3);
+}
+
+TEST(workStealingExecutorTest, IdleWorkersStealNestedTasks) {
+  std::latch done(64);
+  work_stealing_executor executor(executor_options{4});
+  executor.Submit([&] {
+    // Queued to the submitting worker, the others can only run them by stealing
+    for (int i = 0; i < 64; ++i) {
+      executor.Submit([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        done.count_down();
+      });
+    }
+  });
+  done.wait();
+  ASSERT_GT(executor.steals(), 0);
+}
+
+TEST(workStealingExecutorTest, SharedExecutorIsReused) {
+  AwsLabs::Enhanced::configure_shared_executor(executor_options{2});
+  auto executor = AwsLabs::Enhanced::shared_executor();
+  ASSERT_EQ(executor, AwsLabs::Enhanced::shared_executor());
+  ASSERT_EQ(executor->threads(), 2);
+  AwsLabs::Enhanced::release_shared_executor();
+  ASSERT_NE(executor, AwsLabs::Enhanced::shared_executor()) << "A released executor should not be handed out again";
+}
+}
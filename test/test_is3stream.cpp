@@ -99,4 +99,36 @@ TEST_F(is3sIntegrationTest, DetectS3FailureInIs3sOpen) {
   ASSERT_TRUE(is3s.fail() && !is3s.bad());
 }
 
+TEST_F(is3sIntegrationTest, LazyOpenReadsOnFirstRead) {
+  AwsLabs::Enhanced::is3stream is3s(infra.m_region, infra.m_bucket_name, infra.m_object_name,
+                                    AwsLabs::Enhanced::s3open_policy::lazy);
+  ASSERT_TRUE(is3s.is_open()) << "is3s should be open before its first read";
+  std::string result;
+  is3s >> result;
+  ASSERT_FALSE(result.compare("Test")) << "First word extracted is Test";
+}
+
+TEST_F(is3sIntegrationTest, AsyncOpenOverlapsManyObjects) {
+  std::vector<std::unique_ptr<AwsLabs::Enhanced::is3stream>> streams;
+  for (int i = 0; i < 10; ++i) {
+    streams.push_back(std::make_unique<AwsLabs::Enhanced::is3stream>());
+    streams.back()->async_open(infra.m_region, infra.m_bucket_name, infra.m_object_name);
+    ASSERT_TRUE(streams.back()->is_open()) << "async_open should return an open is3s";
+  }
+  for (auto &is3s : streams) {
+    std::string result;
+    *is3s >> result;
+    ASSERT_FALSE(result.compare("Test")) << "First word extracted is Test";
+  }
+}
+
+TEST_F(is3sIntegrationTest, DetectS3FailureInIs3sAsyncOpen) {
+  AwsLabs::Enhanced::is3stream is3s;
+  // "foo" exists but we do not have permission to read
+  is3s.async_open(infra.m_region, "foo", infra.m_object_name);
+  ASSERT_FALSE(is3s.fail()) << "Failure is only known once the request completes";
+  is3s.wait_open();
+  ASSERT_TRUE(is3s.fail() && !is3s.bad());
+}
+
 }
\ No newline at end of file
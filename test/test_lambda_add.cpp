@@ -5,12 +5,20 @@
 
 #include <iostream>
 #include "awslabs/enhanced/lambda_client.h"
+#include "awslabs/enhanced/lambda_event.h"
+#include "awslabs/enhanced/lambda_memo.h"
+#include "awslabs/enhanced/task.h"
 #include "awslabs/enhanced/Aws.h"
 #include "gtest/gtest.h"
+#include "test_helpers.h"
 #include <future>
+#include <numeric>
+#include <tuple>
+#include <vector>
 using namespace expns;
 namespace LambdaDecls {
     int add(int, int);
+    int lookup(AwsLabs::Enhanced::Broadcast<std::vector<int>>, int);
 }
 
 class lambdaIntegrationTest : public ::testing::Test {
@@ -45,3 +53,191 @@ TEST_F(lambdaIntegrationTest, TestInvokeAsync) {
     }, 2, 3);
     EXPECT_EQ(f.get(), 5);
 }
+
+TEST_F(lambdaIntegrationTest, TestInvokeBatch) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  auto batch = add.invoke_batch({{1, 2}, {3, 4}, {5, 6}});
+  EXPECT_EQ(batch.results, std::vector<int>({3, 7, 11}));
+  EXPECT_GE(batch.computeTime.count(), 0);
+}
+
+TEST_F(lambdaIntegrationTest, TestBatchedTransform) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  std::vector<std::tuple<int, int>> args;
+  std::vector<int> expected;
+  for (int i = 0; i < 100; ++i) {
+    args.emplace_back(i, i);
+    expected.push_back(2 * i);
+  }
+  std::vector<int> results(args.size());
+  AwsLabs::Enhanced::cloud_batch policy;
+  policy.initial_batch = 10;
+  policy.max_batch = 25; // the addition is too fast to size batches from its compute time
+  policy.max_in_flight = 2;
+  AwsLabs::Enhanced::transform(policy, args.begin(), args.end(), results.begin(), add);
+  EXPECT_EQ(results, expected);
+}
+
+TEST_F(lambdaIntegrationTest, TestWindowedTransform) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  std::vector<std::tuple<int, int>> args;
+  std::vector<int> expected;
+  for (int i = 0; i < 50; ++i) {
+    args.emplace_back(i, 1);
+    expected.push_back(i + 1);
+  }
+  std::vector<int> results;
+  AwsLabs::Enhanced::transform(AwsLabs::Enhanced::cloud_window{4}, args.begin(), args.end(),
+                               std::back_inserter(results), add);
+  EXPECT_EQ(results, expected) << "Results should be written in input order";
+}
+
+TEST_F(lambdaIntegrationTest, TestHybridTransform) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  std::vector<std::tuple<int, int>> args;
+  std::vector<int> expected;
+  for (int i = 0; i < 200; ++i) {
+    args.emplace_back(i, 1);
+    expected.push_back(i + 1);
+  }
+  std::vector<int> results;
+  AwsLabs::Enhanced::transform(AwsLabs::Enhanced::cloud_hybrid{2, 4}, args.begin(), args.end(),
+                               std::back_inserter(results), add, [](int a, int b) { return a + b; });
+  EXPECT_EQ(results, expected) << "Results should be written in input order";
+}
+
+TEST_F(lambdaIntegrationTest, TestSpeculativeTransform) {
+  auto add = AwsLabs::Enhanced::idempotent(BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn"));
+  std::vector<std::tuple<int, int>> args;
+  std::vector<int> expected;
+  for (int i = 0; i < 100; ++i) {
+    args.emplace_back(i, 1);
+    expected.push_back(i + 1);
+  }
+  std::vector<int> results;
+  AwsLabs::Enhanced::SpeculationReport report;
+  // Speculating on everything slower than the median keeps the speculative path busy
+  AwsLabs::Enhanced::transform(AwsLabs::Enhanced::cloud_speculate{10, 0.5, 1.0, &report}, args.begin(), args.end(),
+                               std::back_inserter(results), add);
+  EXPECT_EQ(results, expected) << "Results should be written in input order";
+  EXPECT_LE(report.wins, report.speculations);
+}
+
+TEST_F(lambdaIntegrationTest, TestCoInvoke) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  auto sumOfAdds = [&](int n) -> AwsLabs::Enhanced::task<int> {
+    std::vector<AwsLabs::Enhanced::task<int>> calls;
+    for (int i = 0; i < n; ++i)
+      calls.push_back([](auto add, int i) -> AwsLabs::Enhanced::task<int> { co_return co_await add.co_invoke(i, 1); }(add, i));
+    auto results = co_await AwsLabs::Enhanced::when_all(std::move(calls));
+    co_return std::accumulate(results.begin(), results.end(), 0);
+  };
+  EXPECT_EQ(AwsLabs::Enhanced::sync_wait(sumOfAdds(100)), 5050);
+}
+
+TEST_F(lambdaIntegrationTest, TestFlatEncoding) {
+  client.flatEncoding = true;
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  EXPECT_EQ(add(1, 3), 4);
+  EXPECT_EQ(add.invoke_batch({{1, 3}, {2, 5}}).results, (std::vector<int>{4, 7}));
+}
+
+TEST_F(lambdaIntegrationTest, TestOffload) {
+  testInfra infra;
+  // Every payload is above a 16 byte threshold, so arguments and result go through the bucket
+  client.offload = AwsLabs::Enhanced::LambdaOffload{infra.m_region, infra.m_bucket_name, "offload/", 16};
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  EXPECT_EQ(add(1, 3), 4);
+  client.offload.reset();
+}
+
+TEST_F(lambdaIntegrationTest, TestBroadcast) {
+  testInfra infra;
+  AwsLabs::Enhanced::LambdaOffload target{infra.m_region, infra.m_bucket_name, "offload/"};
+  std::vector<int> table(1000);
+  std::iota(table.begin(), table.end(), 0);
+  auto first = AwsLabs::Enhanced::broadcast(target, table, true);
+  auto second = AwsLabs::Enhanced::broadcast(target, table);
+  infra.register_test_object(AwsLabs::Enhanced::Detail::parseLocation(first.location).object);
+  // Identical content is stored once
+  EXPECT_EQ(first.location, second.location);
+  EXPECT_EQ(first.get(), second.get());
+  EXPECT_EQ(first->at(999), 999);
+  // Invocations carry only the location
+  using Holder = AwsLabs::Enhanced::Detail::ArgsHolder<int, int, AwsLabs::Enhanced::Broadcast<std::vector<int>>, int>;
+  auto encoded = AwsLabs::Enhanced::Detail::encode(Holder({0, 0, first, 7}));
+  EXPECT_LT(encoded.size(), 200u);
+  auto decoded = AwsLabs::Enhanced::Detail::decode<Holder>(encoded);
+  EXPECT_EQ(*std::get<2>(decoded.tup).get(), table);
+  // The container fetches the table on first use and keeps it for the next invocations
+  auto lookup = BIND_AWS_LAMBDA(client, LambdaDecls::lookup, "test_lambda_broadcast_fn");
+  EXPECT_EQ(lookup(first, 7), 7);
+  EXPECT_EQ(lookup(first, 999), 999);
+}
+
+TEST_F(lambdaIntegrationTest, TestPrewarm) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  EXPECT_EQ(add.prewarm(4), 4u);
+  EXPECT_EQ(add(1, 3), 4);
+}
+
+TEST_F(lambdaIntegrationTest, TestTelemetry) {
+  client.telemetry = std::make_shared<AwsLabs::Enhanced::InvocationTelemetry>();
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  EXPECT_EQ(add(1, 3), 4);
+  EXPECT_EQ(async(AwsLabs::Enhanced::cloud_launch::cloud, add, 2, 3).get(), 5);
+  auto metrics = client.telemetry->snapshot().at("test_lambda_add_fn");
+  EXPECT_EQ(metrics.duration.count(), 2u);
+  EXPECT_GT(metrics.billedDuration.max(), 0);
+  client.telemetry.reset();
+}
+
+TEST_F(lambdaIntegrationTest, TestEventJob) {
+  testInfra infra;
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  {
+    AwsLabs::Enhanced::EventJob job(add, AwsLabs::Enhanced::LambdaOffload{infra.m_region, infra.m_bucket_name, "events/"},
+                                    AwsLabs::Enhanced::EventOptions{std::chrono::milliseconds(200), std::chrono::seconds(60)});
+    auto sum = job.invoke(1, 3);
+    std::vector<int> sums(3);
+    for (int i = 0; i < 3; ++i)
+      EXPECT_EQ(job.submit(i, 10), std::size_t(i + 1));
+    while (auto completed = job.next()) {
+      ASSERT_TRUE(completed->second);
+      sums[completed->first - 1] = *completed->second;
+    }
+    EXPECT_EQ(sum.get(), 4);
+    EXPECT_EQ(sums, (std::vector<int>{10, 11, 12}));
+    EXPECT_EQ(job.outstanding(), 0u);
+  }
+}
+
+TEST_F(lambdaIntegrationTest, TestMemoized) {
+  auto cache = std::make_shared<AwsLabs::Enhanced::MemoCache>();
+  AwsLabs::Enhanced::Memoized add(BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn"), cache);
+  EXPECT_EQ(add(1, 3), 4);
+  EXPECT_EQ(add(1, 3), 4);
+  EXPECT_EQ(add(2, 3), 5);
+  auto stats = cache->stats();
+  EXPECT_EQ(stats.misses, 2u);
+  EXPECT_EQ(stats.hits, 1u);
+}
+
+TEST_F(lambdaIntegrationTest, TestCloudReduce) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  std::vector<int> values(100);
+  std::iota(values.begin(), values.end(), 1);
+  // Small chunks and fan in give a tree of several levels
+  auto sum = AwsLabs::Enhanced::reduce(AwsLabs::Enhanced::cloud_reduce{10, 3}, values.begin(), values.end(), 7, add);
+  EXPECT_EQ(sum, 5057);
+}
+
+TEST_F(lambdaIntegrationTest, TestCloudTransformReduce) {
+  auto add = BIND_AWS_LAMBDA(client, LambdaDecls::add, "test_lambda_add_fn");
+  std::vector<std::tuple<int, int>> args;
+  for (int i = 1; i <= 100; ++i) {
+    args.emplace_back(i, 1);
+  }
+  auto sum = AwsLabs::Enhanced::transform_reduce(AwsLabs::Enhanced::cloud_launch::cloud, args.begin(), args.end(), 0, add);
+  EXPECT_EQ(sum, 5150);
+}
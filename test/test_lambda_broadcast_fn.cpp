@@ -0,0 +1,12 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "awslabs/enhanced/aws_lambda.h"
+#include <vector>
+using namespace AwsLabs::Enhanced;
+
+int lookup(Broadcast<std::vector<int>> table, int index) { return table->at(index); }
+
+AwsLabs::Enhanced::Handler handle(&lookup);
@@ -0,0 +1,79 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/lambda_memo.h"
+
+#include "gtest/gtest.h"
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+using AwsLabs::Enhanced::MemoCache;
+using AwsLabs::Enhanced::MemoCacheOptions;
+
+// Joins key, completing it with value when the caller must compute it, and returns what the waiter saw
+MemoCache::Result lookup(MemoCache &cache, std::string const &key, Aws::String const &value) {
+  MemoCache::Result seen = expns::unexpected(std::string("not called"));
+  if (cache.join(key, [&](MemoCache::Result r) { seen = r; }))
+    cache.complete(key, value);
+  return seen;
+}
+
+TEST(memoCacheTest, IdenticalCallsInFlightCoalesce) {
+  MemoCache cache;
+  std::vector<MemoCache::Result> seen;
+  auto waiter = [&](MemoCache::Result r) { seen.push_back(r); };
+  ASSERT_TRUE(cache.join("k", waiter));
+  ASSERT_FALSE(cache.join("k", waiter));
+  ASSERT_TRUE(seen.empty());
+  cache.complete("k", Aws::String("v"));
+  ASSERT_EQ(seen.size(), 2u);
+  ASSERT_EQ(*seen[0], "v");
+  ASSERT_EQ(*seen[1], "v");
+  ASSERT_FALSE(cache.join("k", waiter));
+  ASSERT_EQ(seen.size(), 3u);
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.misses, 1u);
+  ASSERT_EQ(stats.coalesced, 1u);
+  ASSERT_EQ(stats.hits, 1u);
+}
+
+TEST(memoCacheTest, FailuresAreNotCached) {
+  MemoCache cache;
+  MemoCache::Result seen = Aws::String();
+  ASSERT_TRUE(cache.join("k", [&](MemoCache::Result r) { seen = r; }));
+  cache.complete("k", expns::unexpected(std::string("throttled")));
+  ASSERT_FALSE(seen);
+  ASSERT_EQ(seen.error(), "throttled");
+  ASSERT_TRUE(cache.join("k", [](MemoCache::Result) {}));
+}
+
+TEST(memoCacheTest, LeastRecentlyUsedResultsAreEvicted) {
+  MemoCache cache(MemoCacheOptions{20});
+  lookup(cache, "a", "12345678");
+  lookup(cache, "b", "12345678");
+  ASSERT_EQ(*lookup(cache, "a", "other"), "12345678");
+  lookup(cache, "c", "12345678"); // evicts b, the least recently used
+  ASSERT_EQ(*lookup(cache, "a", "other"), "12345678");
+  ASSERT_EQ(*lookup(cache, "b", "recomputed"), "recomputed");
+  ASSERT_EQ(cache.stats().misses, 4u);
+}
+
+TEST(memoCacheTest, DirectoryKeepsResultsAcrossCaches) {
+  auto directory = std::filesystem::temp_directory_path() / "memo_cache_test";
+  std::filesystem::remove_all(directory);
+  {
+    MemoCache cache(MemoCacheOptions{1024, directory});
+    lookup(cache, "k", "stored");
+  }
+  MemoCache cache(MemoCacheOptions{1024, directory});
+  ASSERT_EQ(*lookup(cache, "k", "recomputed"), "stored");
+  ASSERT_EQ(cache.stats().diskHits, 1u);
+  ASSERT_EQ(*lookup(cache, "k", "recomputed"), "stored");
+  ASSERT_EQ(cache.stats().hits, 1u);
+  std::filesystem::remove_all(directory);
+}
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/pooled_memory.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+using AwsLabs::Enhanced::pooled_memory_system;
+
+TEST(pooledMemoryTest, FreedBlocksAreReused) {
+  auto &memory = pooled_memory_system::instance();
+  auto before = pooled_memory_system::stats();
+  auto first = memory.AllocateMemory(100, 16);
+  ASSERT_NE(first, nullptr);
+  std::memset(first, 0xab, 100);
+  memory.FreeMemory(first);
+  auto second = memory.AllocateMemory(120, 16);
+  ASSERT_EQ(first, second) << "A block of the same size class should come from the thread cache";
+  memory.FreeMemory(second);
+  auto after = pooled_memory_system::stats();
+  ASSERT_EQ(after.allocations - before.allocations, 2);
+  ASSERT_EQ(after.frees - before.frees, 2);
+  ASSERT_GE(after.cache_hits - before.cache_hits, 1);
+}
+
+TEST(pooledMemoryTest, LargeAndOveralignedBlocksGoToMalloc) {
+  auto &memory = pooled_memory_system::instance();
+  auto before = pooled_memory_system::stats();
+  auto large = memory.AllocateMemory(1024 * 1024, 16);
+  auto aligned = memory.AllocateMemory(64, 256);
+  ASSERT_NE(large, nullptr);
+  ASSERT_NE(aligned, nullptr);
+  ASSERT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 256, 0);
+  std::memset(large, 0, 1024 * 1024);
+  std::memset(aligned, 0, 64);
+  memory.FreeMemory(large);
+  memory.FreeMemory(aligned);
+  ASSERT_EQ(pooled_memory_system::stats().large_allocations - before.large_allocations, 2);
+}
+
+TEST(pooledMemoryTest, BlocksCanBeFreedByOtherThreads) {
+  auto &memory = pooled_memory_system::instance();
+  std::vector<void *> blocks;
+  std::thread producer([&] {
+    for (int i = 0; i < 10000; ++i) {
+      blocks.push_back(memory.AllocateMemory(16 + i % 4000, 16));
+    }
+  });
+  producer.join();
+  std::vector<std::thread> consumers;
+  for (int t = 0; t < 4; ++t) {
+    consumers.emplace_back([&, t] {
+      for (std::size_t i = t; i < blocks.size(); i += 4) {
+        memory.FreeMemory(blocks[i]);
+      }
+      for (int i = 0; i < 10000; ++i) {
+        memory.FreeMemory(memory.AllocateMemory(16 + i % 4000, 16));
+      }
+    });
+  }
+  for (auto &consumer : consumers) {
+    consumer.join();
+  }
+  auto stats = pooled_memory_system::stats();
+  ASSERT_EQ(stats.allocations, stats.frees) << "Counters of exited threads should be kept";
+}
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/Aws.h"
+#include "awslabs/enhanced/s3stream.h"
+#include "awslabs/enhanced/s3list.h"
+#include "awslabs/enhanced/rotating_os3stream.h"
+
+#include "gtest/gtest.h"
+#include "test_helpers.h"
+#include <string>
+
+namespace {
+class rotatingOs3sIntegrationTest : public ::testing::Test {
+protected:
+  AwsLabs::Enhanced::AwsApi sdk;
+  testInfra infra;
+
+  std::vector<std::string> written_objects(const std::string &prefix) {
+    std::vector<std::string> objects;
+    AwsLabs::Enhanced::s3prefix_range range(infra.m_region, infra.m_bucket_name, prefix);
+    for (auto entry : range) {
+      objects.emplace_back(entry.key);
+      infra.register_test_object(objects.back());
+    }
+    return objects;
+  }
+};
+
+TEST_F(rotatingOs3sIntegrationTest, ObjectsAreCutBySizeAtLineBoundaries) {
+  AwsLabs::Enhanced::rotation_policy policy;
+  policy.max_bytes = 100;
+  {
+    AwsLabs::Enhanced::rotating_os3stream logs(infra.m_region, infra.m_bucket_name, "size/log-{seq}.txt", policy);
+    for (int i = 0; i < 50; ++i) {
+      logs << "log line number " << i << "\n";
+    }
+    logs.close();
+    ASSERT_FALSE(logs.fail()) << "Every object should be uploaded";
+    ASSERT_GE(logs.rotations(), 5u) << "About 1000 bytes in 100 bytes objects";
+  }
+  auto objects = written_objects("size/");
+  ASSERT_GE(objects.size(), 5u) << "Every cut object should be uploaded";
+  ASSERT_EQ(objects.front(), "size/log-00000000.txt") << "Names should follow the template";
+  std::size_t lines = 0;
+  for (const auto &object : objects) {
+    AwsLabs::Enhanced::is3stream is3s(infra.m_region, infra.m_bucket_name, object);
+    std::string line;
+    while (std::getline(is3s, line)) {
+      ASSERT_EQ(line.rfind("log line number ", 0), 0u) << "Lines should not be split between objects";
+      ++lines;
+    }
+  }
+  ASSERT_EQ(lines, 50u) << "No line should be lost across rotations";
+}
+
+TEST_F(rotatingOs3sIntegrationTest, ObjectsAreCutByAge) {
+  AwsLabs::Enhanced::rotation_policy policy;
+  policy.max_age = std::chrono::seconds(1);
+  {
+    AwsLabs::Enhanced::rotating_os3stream logs(infra.m_region, infra.m_bucket_name, "age/{seq}-{timestamp}", policy);
+    logs << "first\n" << std::flush;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    logs << "second\n" << std::flush;
+  }
+  ASSERT_EQ(written_objects("age/").size(), 2u) << "An expired object should be cut on the next write";
+}
+
+TEST_F(rotatingOs3sIntegrationTest, NothingWrittenCreatesNoObject) {
+  {
+    AwsLabs::Enhanced::rotating_os3stream logs(infra.m_region, infra.m_bucket_name, "empty/{seq}");
+  }
+  ASSERT_TRUE(written_objects("empty/").empty()) << "No object should be created without content";
+}
+}
@@ -298,4 +298,35 @@ TEST_F(s3bufIntegrationTest, WritingAndReadingLongStringBackSucceeds) {
               << "Failed to get the same amount of characters as put";
 
 }
-}
\ No newline at end of file
+
+TEST_F(s3bufIntegrationTest, WrittenObjectIsAccountedToTheGovernor) {
+  auto &governor = AwsLabs::Enhanced::s3buffer_governor::instance();
+  auto before = governor.stats().in_use;
+  std::string test_object_name = "accounted";
+  infra.register_test_object(test_object_name);
+  AwsLabs::Enhanced::s3buf s3b_out;
+  ASSERT_TRUE(s3b_out.open(infra.m_region, infra.m_bucket_name, test_object_name, std::ios_base::out));
+  for (int i = 0; i < 10000; i++) {
+    s3b_out.sputc('x');
+  }
+  ASSERT_GE(governor.stats().in_use, before + 9000) << "The object being written should be accounted";
+  ASSERT_TRUE(s3b_out.close());
+  ASSERT_EQ(governor.stats().in_use, before) << "Closing should release the object";
+}
+
+TEST_F(s3bufIntegrationTest, DegradedOpenFailsWhenTheGovernorIsExhausted) {
+  auto &governor = AwsLabs::Enhanced::s3buffer_governor::instance();
+  auto ceiling = governor.ceiling();
+  int hog;
+  governor.set_ceiling(1024);
+  ASSERT_TRUE(governor.reserve(&hog, 1024));
+  AwsLabs::Enhanced::s3buf s3b;
+  s3b.set_exhaustion(AwsLabs::Enhanced::s3exhaustion::degrade);
+  ASSERT_FALSE(s3b.open(infra.m_region, infra.m_bucket_name, infra.m_object_name, std::ios_base::in))
+              << "Open should fail instead of waiting for memory";
+  ASSERT_FALSE(s3b.is_open());
+  governor.release(&hog, 1024);
+  governor.set_ceiling(ceiling);
+  ASSERT_TRUE(s3b.open(infra.m_region, infra.m_bucket_name, infra.m_object_name, std::ios_base::in));
+}
+}
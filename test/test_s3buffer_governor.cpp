@@ -0,0 +1,92 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/s3buffer_governor.h"
+
+#include "gtest/gtest.h"
+#include <chrono>
+#include <future>
+
+namespace {
+using AwsLabs::Enhanced::s3buffer_governor;
+using AwsLabs::Enhanced::s3exhaustion;
+
+TEST(s3bufferGovernorTest, ReleasedBuffersAreRecycled) {
+  s3buffer_governor governor;
+  int owner;
+  auto first = governor.allocate(&owner, 100);
+  ASSERT_NE(first, nullptr) << "Allocation below the ceiling should succeed";
+  governor.deallocate(&owner, first, 100);
+  auto second = governor.allocate(&owner, 120); // same 128 bytes size class
+  ASSERT_EQ(first, second) << "A pooled buffer of the same size class should be reused";
+  governor.deallocate(&owner, second, 120);
+  auto stats = governor.stats();
+  ASSERT_EQ(stats.allocations, 1u);
+  ASSERT_EQ(stats.recycled, 1u);
+  ASSERT_EQ(stats.in_use, 0u) << "Everything was released";
+}
+
+TEST(s3bufferGovernorTest, DegradeFailsWhenCeilingIsReached) {
+  s3buffer_governor governor;
+  governor.set_ceiling(1024);
+  int owner;
+  ASSERT_TRUE(governor.reserve(&owner, 1000, s3exhaustion::degrade));
+  ASSERT_FALSE(governor.reserve(&owner, 100, s3exhaustion::degrade)) << "The ceiling should not be exceeded";
+  ASSERT_EQ(governor.allocate(&owner, 100, s3exhaustion::degrade), nullptr);
+  ASSERT_EQ(governor.stats().degraded, 2u);
+  governor.release(&owner, 1000);
+  ASSERT_TRUE(governor.reserve(&owner, 100, s3exhaustion::degrade)) << "Released memory should be available again";
+}
+
+TEST(s3bufferGovernorTest, BlockWaitsForReleasedMemory) {
+  s3buffer_governor governor;
+  governor.set_ceiling(1024);
+  int first, second;
+  ASSERT_TRUE(governor.reserve(&first, 1024));
+  auto blocked = std::async(std::launch::async, [&] { return governor.reserve(&second, 512); });
+  ASSERT_EQ(blocked.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout)
+      << "The request should wait while the ceiling is reached";
+  governor.release(&first, 1024);
+  ASSERT_TRUE(blocked.get()) << "The request should be served once memory is released";
+  ASSERT_EQ(governor.stats().blocked, 1u);
+}
+
+TEST(s3bufferGovernorTest, OwnersAboveFairShareYieldToStarvingOwners) {
+  s3buffer_governor governor;
+  governor.set_ceiling(1000);
+  int hog, starving;
+  ASSERT_TRUE(governor.reserve(&hog, 900));
+  ASSERT_FALSE(governor.exhausted(&hog)) << "Nobody else needs memory yet";
+  auto blocked = std::async(std::launch::async, [&] { return governor.reserve(&starving, 400); });
+  while (governor.stats().blocked == 0) {
+    std::this_thread::yield();
+  }
+  ASSERT_TRUE(governor.exhausted(&hog)) << "The hog is above its fair share while another owner waits";
+  ASSERT_FALSE(governor.reserve(&hog, 50, s3exhaustion::degrade)) << "The hog should not grow further";
+  governor.release(&hog, 400);
+  ASSERT_TRUE(blocked.get());
+  ASSERT_FALSE(governor.exhausted(&starving));
+}
+
+TEST(s3bufferGovernorTest, CommitAccountsBeyondTheCeiling) {
+  s3buffer_governor governor;
+  governor.set_ceiling(100);
+  int owner, other;
+  governor.commit(&owner, 150);
+  governor.commit(&other, 10);
+  ASSERT_EQ(governor.stats().in_use, 160u) << "Committed memory is always accounted";
+  ASSERT_TRUE(governor.exhausted(&owner)) << "The owner above its share should give memory back";
+  ASSERT_FALSE(governor.exhausted(&other)) << "Owners within their share are not asked to";
+}
+
+TEST(s3bufferGovernorTest, BlockDoesNotWaitForMemoryOfTheSameThread) {
+  s3buffer_governor governor;
+  governor.set_ceiling(1024);
+  int open, opening;
+  ASSERT_TRUE(governor.reserve(&open, 1024));
+  ASSERT_TRUE(governor.reserve(&opening, 512)) << "The thread holding the memory should not wait for itself";
+  ASSERT_EQ(governor.stats().overdrawn, 1u);
+  ASSERT_EQ(governor.stats().blocked, 0u);
+}
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/Aws.h"
+#include "awslabs/enhanced/s3stream.h"
+#include "awslabs/enhanced/s3list.h"
+
+#include "gtest/gtest.h"
+#include "test_helpers.h"
+#include <string>
+#include <vector>
+
+namespace {
+class s3listIntegrationTest : public ::testing::Test {
+protected:
+  AwsLabs::Enhanced::AwsApi sdk;
+  testInfra infra;
+  std::vector<std::string> keys = {"list/a/1", "list/a/2", "list/b/1", "list/c", "list/d/1"};
+
+  void SetUp() override {
+    for (const auto &key : keys) {
+      infra.register_test_object(key);
+      AwsLabs::Enhanced::os3stream os3s(infra.m_region, infra.m_bucket_name, key);
+      os3s << key;
+    }
+  }
+
+  std::vector<std::string> list(AwsLabs::Enhanced::s3list_options options) {
+    AwsLabs::Enhanced::s3prefix_range range(infra.m_region, infra.m_bucket_name, "list/", options);
+    std::vector<std::string> listed;
+    for (auto entry : range) {
+      listed.emplace_back(entry.key);
+      EXPECT_EQ(entry.size, static_cast<long long>(entry.key.size())) << "Size should match the written content";
+      EXPECT_FALSE(entry.etag.empty()) << "Every entry should carry an ETag";
+    }
+    return listed;
+  }
+};
+
+TEST_F(s3listIntegrationTest, ListsEveryObjectInKeyOrder) {
+  AwsLabs::Enhanced::s3list_options options;
+  options.max_keys = 2; // several pages are needed
+  ASSERT_EQ(list(options), keys) << "All objects under the prefix should be listed in order";
+}
+
+TEST_F(s3listIntegrationTest, KeyRangePartitionsListEveryObjectOnce) {
+  AwsLabs::Enhanced::s3list_options options;
+  options.max_keys = 1;
+  options.boundaries = {"list/b", "list/a/1", "list/c"};
+  ASSERT_EQ(list(options), keys) << "Partitioned listing should not lose nor repeat objects";
+}
+
+TEST_F(s3listIntegrationTest, DelimiterPartitionsListEveryObjectOnce) {
+  AwsLabs::Enhanced::s3list_options options;
+  options.split_delimiter = "/";
+  AwsLabs::Enhanced::s3prefix_range range(infra.m_region, infra.m_bucket_name, "list/", options);
+  std::vector<std::string> listed;
+  for (auto entry : range) {
+    listed.emplace_back(entry.key);
+  }
+  ASSERT_EQ(listed, keys) << "Partitioned listing should not lose nor repeat objects";
+  ASSERT_EQ(range.partitions(), 4u) << "One partition per common prefix plus the tail";
+}
+
+TEST_F(s3listIntegrationTest, EmptyPrefixGivesEmptyRange) {
+  AwsLabs::Enhanced::s3prefix_range range(infra.m_region, infra.m_bucket_name, "missing/");
+  ASSERT_TRUE(range.begin() == range.end()) << "Nothing should be listed under a missing prefix";
+}
+}
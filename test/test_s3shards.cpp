@@ -0,0 +1,85 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/Aws.h"
+#include "awslabs/enhanced/s3stream.h"
+#include "awslabs/enhanced/s3shards.h"
+
+#include "gtest/gtest.h"
+#include "test_helpers.h"
+#include <stdexcept>
+#include <string>
+
+namespace {
+class s3shardsIntegrationTest : public ::testing::Test {
+protected:
+  AwsLabs::Enhanced::AwsApi sdk;
+  testInfra infra;
+
+  std::size_t count_lines(const std::string &object_name) {
+    AwsLabs::Enhanced::is3stream is3s(infra.m_region, infra.m_bucket_name, object_name);
+    EXPECT_TRUE(is3s.is_open()) << object_name << " should have been written";
+    std::size_t lines = 0;
+    std::string line;
+    while (std::getline(is3s, line)) {
+      ++lines;
+    }
+    return lines;
+  }
+};
+
+TEST(s3shardsTest, ZeroShardsAreRejected) {
+  ASSERT_THROW(AwsLabs::Enhanced::s3shard_writer<std::string>(
+                   "us-east-1", "bucket", "shard-", 0, [](const std::string &) { return std::size_t(0); }),
+               std::invalid_argument);
+}
+
+TEST_F(s3shardsIntegrationTest, RecordsAreRoutedByKey) {
+  constexpr std::size_t shards = 4;
+  for (std::size_t i = 0; i < shards; ++i) {
+    infra.register_test_object("shard-" + std::to_string(i));
+  }
+  {
+    AwsLabs::Enhanced::s3shard_writer<std::string> writer(
+        infra.m_region, infra.m_bucket_name, "shard-", shards,
+        [](const std::string &record) { return std::stoul(record); });
+    for (int i = 0; i < 100; ++i) {
+      writer.write(std::to_string(i) + "\n");
+    }
+    ASSERT_TRUE(writer.close()) << "All shards should be uploaded";
+    ASSERT_FALSE(writer.close()) << "Closing a closed writer should fail";
+  }
+  for (std::size_t i = 0; i < shards; ++i) {
+    ASSERT_EQ(count_lines("shard-" + std::to_string(i)), 25u) << "Every shard receives a quarter of the records";
+  }
+}
+
+TEST_F(s3shardsIntegrationTest, ExhaustedBudgetStartsNewSegments) {
+  AwsLabs::Enhanced::s3shard_options options;
+  options.memory_budget = 64;
+  std::size_t segments = 0;
+  {
+    AwsLabs::Enhanced::s3shard_writer<std::string> writer(
+        infra.m_region, infra.m_bucket_name, 2,
+        [&](std::size_t shard, std::size_t segment) {
+          auto name = "budget-" + std::to_string(shard) + "-" + std::to_string(segment);
+          infra.register_test_object(name);
+          segments = std::max(segments, segment + 1);
+          return name;
+        },
+        [](const std::string &record) { return record.size(); },
+        options);
+    for (int i = 0; i < 20; ++i) {
+      writer.write("0123456789\n");
+    }
+    ASSERT_TRUE(writer.close()) << "All segments should be uploaded";
+  }
+  ASSERT_GT(segments, 1u) << "A budget smaller than the data should split the shard in segments";
+  std::size_t lines = 0;
+  for (std::size_t segment = 0; segment < segments; ++segment) {
+    lines += count_lines("budget-1-" + std::to_string(segment)); // records of size 11 go to shard 1
+  }
+  ASSERT_EQ(lines, 20u) << "No record should be lost across segments";
+}
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/task.h"
+
+#include "gtest/gtest.h"
+#include <coroutine>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+using AwsLabs::Enhanced::sync_wait;
+using AwsLabs::Enhanced::task;
+using AwsLabs::Enhanced::when_all;
+
+// Resumes the coroutine on another thread, as an executor completing an invocation does
+struct resume_on_thread {
+  bool await_ready() { return false; }
+  void await_suspend(std::coroutine_handle<> h) { std::thread([h] { h.resume(); }).detach(); }
+  void await_resume() {}
+};
+
+task<int> twice(int x) {
+  co_await resume_on_thread{};
+  co_return 2 * x;
+}
+
+task<int> fails() {
+  co_await resume_on_thread{};
+  throw std::runtime_error("failed");
+}
+
+task<> nothing() {
+  co_return;
+}
+
+task<int> sum_of_twice(int n) {
+  std::vector<task<int>> tasks;
+  for (int i = 0; i < n; ++i) {
+    tasks.push_back(twice(i));
+  }
+  int sum = 0;
+  for (auto x : co_await when_all(std::move(tasks))) {
+    sum += x;
+  }
+  co_return sum;
+}
+
+TEST(taskTest, SyncWaitReturnsTheResult) {
+  ASSERT_EQ(sync_wait(twice(21)), 42);
+  sync_wait(nothing());
+}
+
+TEST(taskTest, WhenAllRunsTasksConcurrently) {
+  ASSERT_EQ(sync_wait(sum_of_twice(1000)), 999000);
+  ASSERT_EQ(sync_wait(sum_of_twice(0)), 0);
+}
+
+TEST(taskTest, ExceptionsPropagate) {
+  ASSERT_THROW(sync_wait(fails()), std::runtime_error);
+  std::vector<task<int>> tasks;
+  tasks.push_back(twice(1));
+  tasks.push_back(fails());
+  ASSERT_THROW(sync_wait(when_all(std::move(tasks))), std::runtime_error);
+}
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "awslabs/enhanced/lambda_telemetry.h"
+
+#include "gtest/gtest.h"
+#include <cstdint>
+#include <string>
+
+namespace {
+using namespace AwsLabs::Enhanced;
+
+std::string const coldLogs =
+    "START RequestId: 8f5 Version: $LATEST\n"
+    "END RequestId: 8f5\n"
+    "REPORT RequestId: 8f5\tDuration: 12.34 ms\tBilled Duration: 13 ms\tMemory Size: 128 MB\t"
+    "Max Memory Used: 41 MB\tInit Duration: 150.50 ms\t\n";
+
+std::string const warmLogs =
+    "START RequestId: 9a1 Version: $LATEST\n"
+    "END RequestId: 9a1\n"
+    "REPORT RequestId: 9a1\tDuration: 2.00 ms\tBilled Duration: 2 ms\tMemory Size: 128 MB\tMax Memory Used: 43 MB\t\n";
+
+TEST(telemetryTest, ReportLinesAreParsed) {
+  auto cold = Detail::parseReport(coldLogs);
+  ASSERT_TRUE(cold);
+  EXPECT_DOUBLE_EQ(cold->durationMs, 12.34);
+  EXPECT_DOUBLE_EQ(cold->billedDurationMs, 13);
+  EXPECT_DOUBLE_EQ(*cold->initDurationMs, 150.5);
+  EXPECT_DOUBLE_EQ(cold->memorySizeMb, 128);
+  EXPECT_DOUBLE_EQ(cold->maxMemoryUsedMb, 41);
+  auto warm = Detail::parseReport(warmLogs);
+  ASSERT_TRUE(warm);
+  EXPECT_DOUBLE_EQ(warm->durationMs, 2);
+  EXPECT_FALSE(warm->initDurationMs);
+  EXPECT_FALSE(Detail::parseReport("START RequestId: 9a1 Version: $LATEST\n"));
+}
+
+TEST(telemetryTest, PercentilesAreWithinABucket) {
+  LatencyHistogram histogram;
+  for (int ms = 1; ms <= 100; ++ms)
+    histogram.record(ms);
+  EXPECT_EQ(histogram.count(), 100u);
+  EXPECT_DOUBLE_EQ(histogram.mean(), 50.5);
+  EXPECT_DOUBLE_EQ(histogram.percentile(1), 100);
+  for (double q : {0.5, 0.9, 0.99}) {
+    EXPECT_GE(histogram.percentile(q), q * 100);
+    EXPECT_LE(histogram.percentile(q), q * 100 * 1.19);
+  }
+}
+
+TEST(telemetryTest, LogTailsAreRecordedByFunction) {
+  InvocationTelemetry telemetry;
+  for (auto const *logs : {&coldLogs, &warmLogs}) {
+    Aws::String base64;
+    Detail::base64Encode(reinterpret_cast<uint8_t const *>(logs->data()), logs->size(), base64);
+    telemetry.recordLogTail("fn", std::string(base64.begin(), base64.end()));
+  }
+  telemetry.recordLogTail("fn", "");
+  auto metrics = telemetry.snapshot().at("fn");
+  EXPECT_EQ(metrics.duration.count(), 2u);
+  EXPECT_EQ(metrics.initDuration.count(), 1u);
+  EXPECT_DOUBLE_EQ(metrics.maxMemoryUsedMb, 43);
+  EXPECT_EQ(metrics.unreported, 1u);
+}
+
+TEST(telemetryTest, ContextTimesAreRecordedByFunction) {
+  InvocationTelemetry telemetry;
+  telemetry.recordContext("fn", 250, 4);
+  telemetry.recordContext("fn", 0, 2);
+  auto metrics = telemetry.snapshot().at("fn");
+  EXPECT_EQ(metrics.contextInit.count(), 1u);
+  EXPECT_DOUBLE_EQ(metrics.contextInit.max(), 250);
+  EXPECT_EQ(metrics.contextCall.count(), 2u);
+  EXPECT_DOUBLE_EQ(metrics.contextCall.mean(), 3);
+}
+}